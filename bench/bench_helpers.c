@@ -0,0 +1,71 @@
+/*
+ * Microbenchmark of window selection. Compares get_window, which handles any width and finds the rows of the window
+ * from the row ratio, with grid_window, which uses the neighbor tables and kernels specialized for the widths used by
+ * the algorithm.
+ *
+ * Build and run from the bench directory:
+ *      gcc -std=gnu99 -O2 -I../src -o bench_helpers bench_helpers.c ../src/helpers.c -lm && ./bench_helpers
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "helpers.h"
+
+#define NROWS 2160
+
+static double seconds(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(void) {
+    int nbins_in_row[NROWS];
+    int basebins[NROWS];
+    int nbins = 0;
+    for (int i = 0; i < NROWS; i++) {
+        double lat = (i + 0.5) * 180. / NROWS - 90;
+        nbins_in_row[i] = (int) floor(2 * NROWS * cos(lat * M_PI / 180.) + 0.5);
+        basebins[i] = nbins;
+        nbins += nbins_in_row[i];
+    }
+    int *data = malloc(nbins * sizeof(int));
+    for (int i = 0; i < nbins; i++) {
+        data[i] = rand() % 50 == 0 ? -999 : rand() % 256;
+    }
+    Grid *grid = new_grid(nbins, NROWS, nbins_in_row, basebins);
+    int window[1024];
+    int widths[3] = {3, 5, 32};
+
+    for (int w = 0; w < 3; w++) {
+        int width = widths[w];
+        int margin = width / 2 + 1;
+        int step = width == 32 ? 32 : 1;
+        long checksum_generic = 0, checksum_grid = 0, count = 0;
+
+        double start = seconds();
+        for (int i = margin; i < NROWS - margin; i += step) {
+            for (int j = basebins[i] + margin; j < basebins[i] + nbins_in_row[i] - margin; j += step) {
+                checksum_generic += get_window(j, i, width, data, nbins_in_row, basebins, window) + window[0];
+                count++;
+            }
+        }
+        double generic = seconds() - start;
+
+        start = seconds();
+        for (int i = margin; i < NROWS - margin; i += step) {
+            for (int j = basebins[i] + margin; j < basebins[i] + nbins_in_row[i] - margin; j += step) {
+                checksum_grid += grid_window(grid, j, i, width, data, window) + window[0];
+            }
+        }
+        double specialized = seconds() - start;
+
+        printf("%2dx%-2d %9ld windows  get_window %7.1f ns  grid_window %7.1f ns  speedup %.2fx%s\n", width, width,
+               count, generic * 1e9 / count, specialized * 1e9 / count, generic / specialized,
+               checksum_generic == checksum_grid ? "" : "  MISMATCH");
+    }
+    del_grid(grid);
+    free(data);
+    return 0;
+}
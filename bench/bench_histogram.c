@@ -0,0 +1,136 @@
+/*
+ * Microbenchmark of histogram construction for 32x32 windows. Compares counting into a single histogram, which is how
+ * get_histogram used to work, with get_histogram, which counts into interleaved sub-histograms, on flat windows where
+ * most values are equal and on high contrast windows split between two populations. Then compares histogram_analysis on
+ * each window with histogram_analysis_batch, which screens out windows that cannot pass before building their
+ * histograms, on a mix of flat, noisy, outlier and front windows, and reports the fraction of windows screened out.
+ * Finally runs the batch on the same windows scaled to 12 bits, which finds the candidate thresholds by sorting the
+ * values of each window instead of building a 4096 level histogram.
+ *
+ * Build and run from the bench directory:
+ *      gcc -std=gnu99 -O2 -I../src -o bench_histogram bench_histogram.c ../src/histogram.c -lm && ./bench_histogram
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "histogram.h"
+#include "cayula.h"
+
+#define NWINDOWS 4096
+#define REPEATS 50
+
+static double seconds(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void single_histogram(const int *data, int *histogram) {
+    memset(histogram, 0, 256 * sizeof(int));
+    for (int i = 0; i < WINDOW_AREA; i++) {
+        if (data[i] != FILL_VALUE) {
+            histogram[data[i]]++;
+        }
+    }
+}
+
+int main(void) {
+    int *windows = malloc(NWINDOWS * WINDOW_AREA * sizeof(int));
+    const char *names[2] = {"flat", "high contrast"};
+    for (int kind = 0; kind < 2; kind++) {
+        for (int w = 0; w < NWINDOWS; w++) {
+            int *window = windows + w * WINDOW_AREA;
+            int low = rand() % 128;
+            for (int i = 0; i < WINDOW_AREA; i++) {
+                if (kind == 0) {
+                    window[i] = low + (rand() % 8 == 0);
+                } else {
+                    window[i] = (i % WINDOW_WIDTH) < WINDOW_WIDTH / 2 ? low + rand() % 16 : 200 + rand() % 40;
+                }
+                if (rand() % 20 == 0) window[i] = FILL_VALUE;
+            }
+        }
+        int histogram[256];
+        long checksum_single = 0, checksum_banked = 0;
+
+        double start = seconds();
+        for (int r = 0; r < REPEATS; r++) {
+            for (int w = 0; w < NWINDOWS; w++) {
+                single_histogram(windows + w * WINDOW_AREA, histogram);
+                checksum_single += histogram[w & 255];
+            }
+        }
+        double single = seconds() - start;
+
+        start = seconds();
+        for (int r = 0; r < REPEATS; r++) {
+            for (int w = 0; w < NWINDOWS; w++) {
+                get_histogram(windows + w * WINDOW_AREA, histogram);
+                checksum_banked += histogram[w & 255];
+            }
+        }
+        double banked = seconds() - start;
+
+        long count = (long) NWINDOWS * REPEATS;
+        printf("%-13s single %7.1f ns  banked %7.1f ns  speedup %.2fx%s\n", names[kind], single * 1e9 / count,
+               banked * 1e9 / count, single / banked, checksum_single == checksum_banked ? "" : "  MISMATCH");
+    }
+
+    int thresholds[NWINDOWS];
+    for (int w = 0; w < NWINDOWS; w++) {
+        int *window = windows + w * WINDOW_AREA;
+        int low = rand() % 128;
+        int kind = w % 4;
+        for (int i = 0; i < WINDOW_AREA; i++) {
+            if (kind == 0) {
+                window[i] = low;
+            } else if (kind == 1) {
+                window[i] = low + rand() % 6;
+            } else if (kind == 2) {
+                window[i] = low + (rand() % 50 == 0) * 30;
+            } else {
+                window[i] = low + rand() % 4 + ((i % WINDOW_WIDTH) < WINDOW_WIDTH / 2) * 40;
+            }
+            if (rand() % 20 == 0) window[i] = FILL_VALUE;
+        }
+    }
+    long checksum_single = 0, checksum_batch = 0, skipped = 0;
+    double start = seconds();
+    for (int r = 0; r < REPEATS; r++) {
+        for (int w = 0; w < NWINDOWS; w++) checksum_single += histogram_analysis(windows + w * WINDOW_AREA);
+    }
+    double single = seconds() - start;
+    start = seconds();
+    for (int r = 0; r < REPEATS; r++) {
+        skipped += histogram_analysis_batch(windows, NWINDOWS, 256, thresholds, NULL);
+        for (int w = 0; w < NWINDOWS; w++) checksum_batch += thresholds[w];
+    }
+    double batch = seconds() - start;
+    long count = (long) NWINDOWS * REPEATS;
+    printf("%-13s single %7.1f ns  batch  %7.1f ns  speedup %.2fx  screened out %.1f%%%s\n", "analysis",
+           single * 1e9 / count, batch * 1e9 / count, single / batch, 100.0 * skipped / count,
+           checksum_single == checksum_batch ? "" : "  MISMATCH");
+
+    int *scaled = malloc(NWINDOWS * WINDOW_AREA * sizeof(int));
+    for (int i = 0; i < NWINDOWS * WINDOW_AREA; i++) {
+        scaled[i] = windows[i] == FILL_VALUE ? FILL_VALUE : windows[i] * 16;
+    }
+    int scaled_thresholds[NWINDOWS];
+    int mismatch = 0;
+    start = seconds();
+    for (int r = 0; r < REPEATS; r++) {
+        histogram_analysis_batch(scaled, NWINDOWS, 4096, scaled_thresholds, NULL);
+    }
+    double sorted = seconds() - start;
+    histogram_analysis_batch(windows, NWINDOWS, 256, thresholds, NULL);
+    for (int w = 0; w < NWINDOWS; w++) {
+        //Scaling every value by 16 keeps the same split, just above the largest value of the low group
+        if (scaled_thresholds[w] != (thresholds[w] < 0 ? -1 : 16 * (thresholds[w] - 1) + 1)) mismatch = 1;
+    }
+    printf("%-13s 8 bit  %7.1f ns  12 bit %7.1f ns  ratio   %.2fx%s\n", "levels", batch * 1e9 / count,
+           sorted * 1e9 / count, sorted / batch, mismatch ? "  MISMATCH" : "");
+    free(scaled);
+    free(windows);
+    return 0;
+}
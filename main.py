@@ -5,6 +5,8 @@ import numpy as np
 import pandas as pd
 from multiprocessing import Pool, cpu_count
 
+#Largest number of levels the library handles, MAX_LEVELS in helpers.h
+MAX_LEVELS = 4096
 
 class EdgeDetector:
 
@@ -30,19 +32,48 @@ class EdgeDetector:
         aoi_bins = (ctypes.c_int * num_aoi_bins)(*aoi_bins)
         return lats[aoi_bins], lons[aoi_bins], basebins, nbins_in_row, aoi_bins, num_aoi_bins, num_aoi_rows
 
-    def __init__(self, nbins, nrows, min_lat, min_lon, max_lat, max_lon):
+    def __init__(self, nbins, nrows, min_lat, min_lon, max_lat, max_lon, nthreads=1, levels=256, tile_contours=False,
+                 gradient_field=False):
+        if not 2 <= levels <= MAX_LEVELS:
+            raise ValueError("levels must be between 2 and {}, got {}".format(MAX_LEVELS, levels))
         self.nbins = nbins
         self.nrows = nrows
         self.min_lat = min_lat
         self.min_lon = min_lon
         self.max_lat = max_lat
         self.max_lon = max_lon
+        self.nthreads = nthreads
+        self.levels = levels
+        self.tile_contours = tile_contours
+        self.gradient_field = gradient_field
         self.lats, self.lons, self.basebins, self.nbins_in_row, self.aoi_bins, self.num_aoi_bins, self.num_aoi_rows = self.__find_aoi_bins()
+        self._cayula = None
+        self._grid = None
+
+    def __del__(self):
+        if self._grid is not None:
+            self._cayula.del_grid(self._grid)
+
+    def __load_library(self):
+        """
+        Loads the edge detection library and builds the descriptor of the area of interest binning scheme, which is
+        shared by every call to sied
+        """
+        self._cayula = ctypes.CDLL('./sied.so')
+        self._cayula.new_grid.restype = ctypes.c_void_p
+        self._cayula.new_grid.argtypes = (ctypes.c_int, ctypes.c_int, ctypes.POINTER(ctypes.c_int),
+                                          ctypes.POINTER(ctypes.c_int))
+        self._cayula.del_grid.argtypes = (ctypes.c_void_p,)
+        self._cayula.cayula_grid.argtypes = (ctypes.c_void_p, ctypes.POINTER(ctypes.c_int), ctypes.POINTER(ctypes.c_int),
+                                             ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int)
+        self._grid = self._cayula.new_grid(self.num_aoi_bins, self.num_aoi_rows, self.nbins_in_row, self.basebins)
+        if self._grid is None:
+            raise MemoryError("Could not build the binning scheme descriptor")
 
     def initialize(self, data, data_bins):
         min_val = np.min(data)
         max_val = np.max(data)
-        int_data = np.floor(255 * (data + abs(min_val)) / abs(max_val - min_val)).astype(np.int)
+        int_data = np.floor((self.levels - 1) * (data + abs(min_val)) / abs(max_val - min_val)).astype(np.int)
         index = range(0, len(self.aoi_bins))
         aoi_bins = np.array(self.aoi_bins[:])
         sorted_index = np.searchsorted(aoi_bins, data_bins)
@@ -65,13 +96,13 @@ class EdgeDetector:
         return aoi_data
 
     def sied(self, data, data_bins):
-        _cayula = ctypes.CDLL('./sied.so')
+        if self._grid is None:
+            self.__load_library()
         aoi_data = self.initialize(data, data_bins)
         aoi_data_arr = (ctypes.c_int * self.num_aoi_bins)(*aoi_data)
-        _cayula.cayula.argtypes = (ctypes.POINTER(ctypes.c_int), ctypes.POINTER(ctypes.c_int),
-                                   ctypes.c_int, ctypes.c_int, ctypes.POINTER(ctypes.c_int), ctypes.POINTER(ctypes.c_int))
         out_data = (ctypes.c_int * self.num_aoi_bins)()
-        _cayula.cayula(aoi_data_arr, out_data, self.num_aoi_bins, self.num_aoi_rows, self.nbins_in_row, self.basebins)
+        self._cayula.cayula_grid(self._grid, aoi_data_arr, out_data, self.levels, self.nthreads,
+                                 int(self.tile_contours), int(self.gradient_field))
         df = pd.DataFrame(data={"Data": out_data[:self.num_aoi_bins]})
         df["Latitude"] = self.lats
         df["Longitude"] = self.lons
@@ -136,7 +167,7 @@ def map_files(directory, latmin, latmax, lonmin, lonmax):
 
     dataset = Dataset(files[0])
     ntotal_bins, nrows, data_bins, data, date = get_params_modis(dataset, "chlor_a")
-    detector = EdgeDetector(ntotal_bins, nrows, 20, -180, 80, -120)
+    detector = EdgeDetector(ntotal_bins, nrows, 20, -180, 80, -120, nthreads=cpu_count())
     dataset.close()
     for file in files:
         dataset = Dataset(file)
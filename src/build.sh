@@ -1,10 +1,11 @@
 #!/bin/bash
-gcc -std=gnu99 -c -g -fPIC -pthread -o filter.o filter.c
-gcc -std=gnu99 -c -g -fPIC -pthread -o cayula.o cayula.c
-gcc -std=gnu99 -c -g -fPIC -pthread -o helpers.o helpers.c
-gcc -std=gnu99 -c -g -fPIC -pthread -o cohesion.o cohesion.c
-gcc -std=gnu99 -c -g -fPIC -pthread -o contour.o contour.c
-gcc -std=gnu99 -c -g -fPIC -pthread -o histogram.o histogram.c
+gcc -std=gnu99 -c -g -O2 -fPIC -pthread -o filter.o filter.c
+gcc -std=gnu99 -c -g -O2 -fPIC -pthread -o cayula.o cayula.c
+gcc -std=gnu99 -c -g -O2 -fPIC -pthread -o helpers.o helpers.c
+gcc -std=gnu99 -c -g -O2 -fPIC -pthread -o cohesion.o cohesion.c
+gcc -std=gnu99 -c -g -O2 -fPIC -pthread -o contour.o contour.c
+gcc -std=gnu99 -c -g -O2 -fPIC -pthread -o histogram.o histogram.c
+gcc -std=gnu99 -c -g -O2 -fPIC -pthread -o tiles.o tiles.c
 
-gcc -shared -fPIC -pthread -g -o ../sied.so filter.o cayula.o helpers.o cohesion.o contour.o histogram.o
+gcc -shared -fPIC -pthread -g -O2 -o ../sied.so filter.o cayula.o helpers.o cohesion.o contour.o histogram.o tiles.o
 
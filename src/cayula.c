@@ -4,54 +4,150 @@
 #include "cohesion.h"
 #include "contour.h"
 #include "filter.h"
+#include "tiles.h"
 #include "cayula.h"
 
+/*
+ * Function:  cayula
+ * --------------------
+ * Runs the single image edge detection algorithm on the given data. Builds a descriptor of the binning scheme for this
+ * call only. Callers processing many images of the same area should build it once with new_grid and use cayula_grid.
+ *
+ * args:
+ *      int *data: pointer to an array containing the data values of each bin ranging from 0 to 255
+ *      int *out_data: pointer to an array to write the front values for each bin. 1 for a front, 0 for not and -1
+ *      for bins without data
+ *      int n_bins: the number of bins in the binning scheme
+ *      int nrows: the number of rows in the binning scheme
+ *      int *n_bins_in_row: pointer to an array containing the number of bins in each row
+ *      int *basebins: pointer to an array containing the bin number of the first bin in each row
+ */
 void cayula(int *data, int *out_data, int n_bins, int nrows, int *n_bins_in_row, int *basebins) {
-    int *filtered_data = malloc(n_bins * sizeof(int));
+    Grid *grid = new_grid(n_bins, nrows, n_bins_in_row, basebins);
+    if (grid == NULL) return;
+    cayula_grid(grid, data, out_data, 256, 1, 0, 0);
+    del_grid(grid);
+}
 
-    median_filter(data, filtered_data, n_bins, nrows, n_bins_in_row, basebins);
-    int *edge_pixels = malloc(n_bins * sizeof(int));
+/*
+ * State of the window steps carried between the rows handed over by the streaming median filter. gradients is NULL
+ * unless the gradient field is computed as the rows are filtered.
+ */
+struct band_analysis {
+    const Grid *grid;
+    int levels;
+    Band *band;
+    int *thresholds;
+    uint64_t *edge_pixels;
+    GradientField *gradients;
+    int next_row;
+} typedef BandAnalysis;
 
-    for (int i = 0; i < n_bins; i++) {
-        if (data[i] == FILL_VALUE) {
-            out_data[i] = -1;
-        } else {
-            out_data[i] = 0;
+/*
+ * Function:  analyze_bands
+ * --------------------
+ * Runs the histogram, cohesion and edge steps on the windows centered on a row once all the filtered rows they reach
+ * are available. The windows of the row i reach from row i - WINDOW_WIDTH / 2 + 1 to row i + WINDOW_WIDTH / 2, and
+ * their rows can run one row further at either end where the rows above and below are shorter. They are analyzed
+ * when the row after that is filtered, or when the last row is. The gradients of the row before the one just filtered
+ * are computed too when there is a gradient field.
+ *
+ * args:
+ *      void *context: the BandAnalysis
+ *      Plane *rows: the most recently filtered rows
+ *      int row: the row just filtered
+ */
+static void analyze_bands(void *context, const Plane *rows, int row) {
+    BandAnalysis *analysis = context;
+    const Grid *grid = analysis->grid;
+    const int *n_bins_in_row = grid->nbins_in_row;
+    int half_step = WINDOW_WIDTH / 2;
+    if (analysis->gradients != NULL) gradient_rows(analysis->gradients, rows, grid, row - 1, row);
+    while (analysis->next_row < grid->nrows - half_step &&
+           (analysis->next_row + half_step + 1 <= row || row == grid->nrows - 1)) {
+        int i = analysis->next_row;
+        analysis->next_row += WINDOW_WIDTH;
+        //The rows checked can lie past either end of the map, which then counts as its first or last row
+        int first_row = i - WINDOW_WIDTH + 1 > 0 ? i - WINDOW_WIDTH + 1 : 0;
+        int last_row = i + WINDOW_WIDTH < grid->nrows ? i + WINDOW_WIDTH : grid->nrows - 1;
+        if (n_bins_in_row[first_row] < WINDOW_WIDTH || n_bins_in_row[last_row] < WINDOW_WIDTH) {
+            continue;
+        }
+        Band *band = analysis->band;
+        load_band(band, grid, rows, i);
+        histogram_analysis_batch(band->values, band->ntiles, analysis->levels, analysis->thresholds, NULL);
+        for (int j = 0; j < band->ntiles; j++) {
+            const int *window = band->values + j * WINDOW_AREA;
+            int threshold = analysis->thresholds[j];
+            uint32_t edge_rows[WINDOW_WIDTH];
+            if (threshold > 0 && find_cohesive_edge(window, threshold, edge_rows)) {
+                scatter_tile(band, j, edge_rows, analysis->edge_pixels);
+            }
         }
-        edge_pixels[i] = 0;
     }
+}
 
-    int half_step = WINDOW_WIDTH / 2;
-    int *edge_window = malloc(WINDOW_AREA * sizeof(int));
-    int *window = malloc(WINDOW_AREA * sizeof(int));
-    int *bin_window = malloc(WINDOW_AREA * sizeof(int));
-    for (int i = half_step - 1; i < nrows - half_step; i += WINDOW_WIDTH) {
-        for (int j = half_step - 1; j < n_bins_in_row[i] - half_step; j += WINDOW_WIDTH) {
-            if (n_bins_in_row[i - WINDOW_WIDTH + 1] < WINDOW_WIDTH || n_bins_in_row[i + WINDOW_WIDTH] < WINDOW_WIDTH) {
-                continue;
+/*
+ * Function:  cayula_grid
+ * --------------------
+ * Runs the single image edge detection algorithm on the given data using a previously built descriptor of the binning
+ * scheme. The data is converted once to a plane of 16 bit values with a validity bitmap. The median filter streams the
+ * filtered rows to the window steps, which analyze each band of windows as soon as its rows are filtered, so the
+ * filtered map is never held whole. The contour step filters the few bins it computes gradients from on demand, or
+ * reads them from a gradient field computed from the rows as they are filtered. Edge pixels are kept in a bitmap.
+ *
+ * args:
+ *      Grid *grid: descriptor of the binning scheme
+ *      int *data: pointer to an array containing the data values of each bin ranging from 0 to levels - 1. Values
+ *      outside of that range are clamped to it.
+ *      int *out_data: pointer to an array to write the front values for each bin. 1 for a front, 0 for not and -1
+ *      for bins without data
+ *      int levels: the number of levels the data is quantized to, from 2 to MAX_LEVELS. 256 for 8 bit data. For any
+ *      other number of levels, every bin is marked as without data.
+ *      int nthreads: the number of threads to use for the stages that run in parallel
+ *      int tile_contours: nonzero to trace the contours in bands of rows in parallel and stitch them, zero to trace
+ *      them over the whole map in a single thread. Tiled contours do not depend on the number of threads, but can
+ *      differ slightly from those traced over the whole map where fronts cross from one band into the next.
+ *      int gradient_field: nonzero to compute the gradient of every bin once as the rows are filtered, zero to compute
+ *      the gradients the contours need on demand. The gradient field takes 4 bytes per bin. Its gradients are those
+ *      of the 3x3 window around each bin. On demand, the window of each neighbor of a contour point is taken around
+ *      the row of the point offset by the column of the neighbor rather than by its row, so the gradients of the
+ *      neighbors, and with them the fronts, differ on any grid, rectangular or not.
+ */
+void cayula_grid(const Grid *grid, int *data, int *out_data, int levels, int nthreads, int tile_contours,
+                 int gradient_field) {
+    int n_bins = grid->nbins;
+    //More levels would overflow the histograms of the median filter and of the histogram step
+    if (levels < 2 || levels > MAX_LEVELS) {
+        for (int i = 0; i < n_bins; i++) out_data[i] = -1;
+        return;
+    }
+    Plane *plane = new_plane(n_bins);
+    //Without memory for the gradient field, the gradients are computed on demand
+    GradientField *gradients = gradient_field ? new_gradient_field(n_bins) : NULL;
+    BandAnalysis analysis = {grid, levels, new_band(grid), NULL, new_bitmap(n_bins), gradients, WINDOW_WIDTH / 2 - 1};
+    if (analysis.band != NULL) analysis.thresholds = malloc(analysis.band->max_tiles * sizeof(int));
+    if (plane != NULL && analysis.band != NULL && analysis.thresholds != NULL && analysis.edge_pixels != NULL) {
+        plane_from_ints(plane, data, levels);
+        for (int i = 0; i < n_bins; i++) {
+            if (data[i] == FILL_VALUE) {
+                out_data[i] = -1;
+            } else {
+                out_data[i] = 0;
             }
-            get_window(basebins[i] + j, i, WINDOW_WIDTH, filtered_data, n_bins_in_row, basebins, window);
-            int threshold = histogram_analysis(window);
-            if (threshold > 0) {
-                get_bin_window(basebins[i] + j, i, WINDOW_WIDTH, n_bins_in_row, basebins, bin_window);
-                if (cohesive(window, threshold)) {
-                    find_edge(window, edge_window, threshold);
-                    for (int k = 0; k < WINDOW_WIDTH; k++) {
-                        for (int m = 0; m < WINDOW_WIDTH; m++) {
-                            if (edge_window[k * WINDOW_WIDTH + m]) {
-                                edge_pixels[bin_window[k * WINDOW_WIDTH + m]] = edge_window[k * WINDOW_WIDTH + m];
-                            }
-                        }
-                    }
-                }
+        }
+        //Windows reach one row past the WINDOW_WIDTH rows they are centered on at either end
+        if (median_filter_stream(plane, grid, WINDOW_WIDTH + 2, nthreads, analyze_bands, &analysis)) {
+            if (tile_contours) {
+                contour_tiled(analysis.edge_pixels, plane, 1, gradients, out_data, grid, nthreads);
+            } else {
+                contour(analysis.edge_pixels, plane, 1, gradients, out_data, grid);
             }
         }
     }
-    free(edge_window);
-    free(window);
-    free(bin_window);
-    contour(edge_pixels, filtered_data, out_data, n_bins, nrows, n_bins_in_row, basebins);
-    free(filtered_data);
-    free(edge_pixels);
+    free(analysis.thresholds);
+    del_band(analysis.band);
+    del_plane(plane);
+    del_gradient_field(gradients);
+    free(analysis.edge_pixels);
 }
-
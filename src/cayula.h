@@ -4,9 +4,33 @@
 
 #ifndef CAYULA_H
 #define CAYULA_H
+#include "helpers.h"
 
 #define WINDOW_WIDTH 32
 #define WINDOW_AREA 1024
 #define FILL_VALUE -999
+
+/*
+ * Reads the value of a bin of a plane, or a fill value if the bin is invalid.
+ */
+static inline int plane_value(const Plane *plane, int bin) {
+    return plane_valid(plane, bin) ? plane->values[bin - plane->first] : FILL_VALUE;
+}
+
+/*
+ * Writes the value of a bin of a plane, marking the bin invalid if the value is a fill value. Bins sharing a word of
+ * the validity bitmap must not be written by different threads.
+ */
+static inline void plane_set(Plane *plane, int bin, int value) {
+    if (value == FILL_VALUE) {
+        bitmap_clear(plane->valid, bin - plane->first);
+    } else {
+        plane->values[bin - plane->first] = value;
+        bitmap_set(plane->valid, bin - plane->first);
+    }
+}
+
 void cayula(int *data, int *out_data, int n_bins, int nrows, int *n_bins_in_row, int *basebins);
+void cayula_grid(const Grid *grid, int *data, int *out_data, int levels, int nthreads, int tile_contours,
+                 int gradient_field);
 #endif //CAYULA_H
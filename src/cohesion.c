@@ -1,106 +1,264 @@
+#include <stdint.h>
 #include "cohesion.h"
 #include "cayula.h"
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 #define CRIT_C1 0.90
 #define CRIT_C2 0.90
 #define CRIT_C 0.92
 
-static inline int squarei(int a) {
-    return a * a;
+/*
+ * Function:  popcount64
+ * --------------------
+ * Counts the set bits of a word. Without a popcount instruction the builtin is a library call, so the bits are summed
+ * in parallel within the word instead.
+ */
+static inline int popcount64(uint64_t x) {
+#ifdef __POPCNT__
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555);
+    x = (x & 0x3333333333333333) + ((x >> 2) & 0x3333333333333333);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0f;
+    return (int) ((x * 0x0101010101010101) >> 56);
+#endif
 }
 
-static inline int min(int a, int b) {
-    return a < b ? a : b;
-}
+#ifdef __SSE2__
 
-static inline int max(int a, int b) {
-    return a > b ? a : b;
+/*
+ * Function:  threshold_masks
+ * --------------------
+ * Thresholds a window into one bit per pixel. Bit j of row i of each mask stands for column j of row i of the window.
+ * The comparisons are made 4 pixels at a time and their sign bits gathered with movemask.
+ *
+ * args:
+ *      int *window: pointer to an array containing the data window
+ *      int threshold: the threshold to separate the two groups by
+ *      uint32_t *above: pointer to a WINDOW_WIDTH element array for the masks of the valid pixels at or above the
+ *      threshold
+ *      uint32_t *valid: pointer to a WINDOW_WIDTH element array for the masks of the valid pixels
+ */
+static void threshold_masks(const int *window, int threshold, uint32_t *above, uint32_t *valid) {
+    __m128i fill = _mm_set1_epi32(FILL_VALUE);
+    __m128i below = _mm_set1_epi32(threshold - 1);
+    for (int i = 0; i < WINDOW_WIDTH; i++) {
+        uint32_t a = 0, f = 0;
+        for (int j = 0; j < WINDOW_WIDTH; j += 4) {
+            __m128i values = _mm_loadu_si128((const __m128i *) (window + i * WINDOW_WIDTH + j));
+            f |= (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(values, fill))) << j;
+            a |= (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(values, below))) << j;
+        }
+        valid[i] = ~f;
+        above[i] = a & ~f;
+    }
 }
+#else
 
 /*
- * Function:  cohesive
+ * Function:  threshold_masks
  * --------------------
- * Determines if the two groups in the window divided separated by the given threshold is sufficiently cohesive.
- * Compares each bin to its neighbors to see if members of each group are near other members.
+ * Thresholds a window into one bit per pixel. Bit j of row i of each mask stands for column j of row i of the window.
  *
  * args:
  *      int *window: pointer to an array containing the data window
  *      int threshold: the threshold to separate the two groups by
+ *      uint32_t *above: pointer to a WINDOW_WIDTH element array for the masks of the valid pixels at or above the
+ *      threshold
+ *      uint32_t *valid: pointer to a WINDOW_WIDTH element array for the masks of the valid pixels
+ */
+static void threshold_masks(const int *window, int threshold, uint32_t *above, uint32_t *valid) {
+    for (int i = 0; i < WINDOW_WIDTH; i++) {
+        uint32_t a = 0, v = 0;
+        for (int j = 0; j < WINDOW_WIDTH; j++) {
+            int value = window[i * WINDOW_WIDTH + j];
+            uint32_t is_valid = value != FILL_VALUE;
+            v |= is_valid << j;
+            a |= (is_valid & (value >= threshold)) << j;
+        }
+        above[i] = a;
+        valid[i] = v;
+    }
+}
+#endif
+
+/*
+ * Function:  diagonal_pairs
+ * --------------------
+ * Counts the pairs of diagonal neighbors between the pixels of one row and those of an adjacent row. Bit j of the
+ * adjacent row shifted left by one is its pixel at column j - 1, and shifted right by one its pixel at column j + 1, so
+ * the neighbors falling outside of the window are shifted out. Both directions are counted with one popcount of the
+ * two masks side by side in a 64 bit word. The count is the same with the two rows swapped.
+ *
+ * args:
+ *      uint32_t row: mask of the pixels of the row
+ *      uint32_t adjacent: mask of the pixels of the adjacent row
+ * returns:
+ *      int: the number of pairs
+ */
+static inline int diagonal_pairs(uint32_t row, uint32_t adjacent) {
+    return popcount64((uint64_t) (row & (adjacent << 1)) << 32 | (row & (adjacent >> 1)));
+}
+
+/*
+ * Function:  cohesive_masks
+ * --------------------
+ * Determines if the two groups of a thresholded window are sufficiently cohesive. Compares each bin to its diagonal
+ * neighbors to see if members of each group are near other members. Each row of the window fits in a 32 bit mask, so
+ * the neighbors of a whole row are counted at once with shifts and popcounts.
+ *
+ * Between each two adjacent rows, the pairs of pixels below the threshold are counted once for each of their two
+ * pixels, as are the pairs above it, while each mixed pair counts as one neighbor of a pixel below and one of a pixel
+ * above. The mixed pairs are the pairs of valid pixels less the other two.
+ *
+ * args:
+ *      uint32_t *above: pointer to the WINDOW_WIDTH masks of the valid pixels at or above the threshold
+ *      uint32_t *below: pointer to the WINDOW_WIDTH masks of the valid pixels below the threshold
+ *      uint32_t *valid: pointer to the WINDOW_WIDTH masks of the valid pixels
  *
  * returns:
  *      int: 1 if the threshold results in cohesive groups 0 if it does not
  */
-int cohesive(const int *window, int threshold) {
-    int copy[1024] = {0};
+static int cohesive_masks(const uint32_t *above, const uint32_t *below, const uint32_t *valid) {
+    int below_pairs = 0, above_pairs = 0, mixed_pairs = 0;
+    for (int i = 0; i < WINDOW_WIDTH - 1; i++) {
+        int low = diagonal_pairs(below[i], below[i + 1]);
+        int high = diagonal_pairs(above[i], above[i + 1]);
+        below_pairs += low;
+        above_pairs += high;
+        mixed_pairs += diagonal_pairs(valid[i], valid[i + 1]) - low - high;
+    }
+    int r1 = 2 * below_pairs, t1 = r1 + mixed_pairs;
+    int r2 = 2 * above_pairs, t2 = r2 + mixed_pairs;
+    double c = (double) (r1 + r2) / (t1 + t2);
+    return ((double) r1 / t1 >= CRIT_C1 && (double) r2 / t2 >= CRIT_C2 && c >= CRIT_C);
+}
 
+/*
+ * Function:  spread
+ * --------------------
+ * Marks the pixels of a row mask along with their left and right neighbors, dropping those outside of the window.
+ */
+static inline uint32_t spread(uint32_t row) {
+    return row | row << 1 | row >> 1;
+}
 
-    for (int i = 0; i < 1024; i++) {
-        copy[i] = window[i] == FILL_VALUE ? FILL_VALUE : window[i] >= threshold;
+/*
+ * Function:  edge_masks
+ * --------------------
+ * Finds the edge pixels of a thresholded window. Each group is spread to the columns next to its pixels. A pixel above
+ * the threshold is an edge pixel if the spread pixels below the threshold of its own row or of the rows above and
+ * below reach it, and the other way around. Fill pixels are in neither group, so they neither are edge pixels nor make
+ * their neighbors ones.
+ *
+ * args:
+ *      uint32_t *above: pointer to the WINDOW_WIDTH masks of the valid pixels at or above the threshold
+ *      uint32_t *below: pointer to the WINDOW_WIDTH masks of the valid pixels below the threshold
+ *      uint32_t *out: pointer to a WINDOW_WIDTH element array to which to write the masks of the edge pixels
+ */
+static void edge_masks(const uint32_t *above, const uint32_t *below, uint32_t *out) {
+    uint32_t near_above[WINDOW_WIDTH + 2] = {0}, near_below[WINDOW_WIDTH + 2] = {0};
+    //The spread rows are offset by one so that the rows outside of the window are empty
+    for (int i = 0; i < WINDOW_WIDTH; i++) {
+        near_above[i + 1] = spread(above[i]);
+        near_below[i + 1] = spread(below[i]);
     }
-    double r1 = 0, t1 = 0, r2 = 0, t2 = 0;
     for (int i = 0; i < WINDOW_WIDTH; i++) {
-        for (int j = 0; j < WINDOW_WIDTH; j++) {
-            int sum = 0;
-            int count = 0;
-            if (copy[i * WINDOW_WIDTH + j] != FILL_VALUE) {
-                for (int k = max(i - 1, 0); k < min(i + 2, WINDOW_WIDTH); k++) {
-                    for (int l = max(j - 1, 0); l < min(j + 2, WINDOW_WIDTH); l++) {
-                        if (k != i && l != j && copy[k * WINDOW_WIDTH + l] != FILL_VALUE) {
-                            sum += copy[k * WINDOW_WIDTH + l];
-                            count++;
-                        }
-                    }
-                }
-                if (copy[i * WINDOW_WIDTH + j] == 0) {
-                    r1 += count - sum;
-                    t1 += count;
-                } else {
-                    r2 += sum;
-                    t2 += count;
-                }
-            }
-        }
+        uint32_t reach_above = near_above[i] | near_above[i + 1] | near_above[i + 2];
+        uint32_t reach_below = near_below[i] | near_below[i + 1] | near_below[i + 2];
+        out[i] = (above[i] & reach_below) | (below[i] & reach_above);
     }
-    double c = (r1 + r2)/(t1 + t2);
-    return (r1/t1 >= CRIT_C1 && r2/t2 >= CRIT_C2 && c >= CRIT_C);
 }
 
 /*
- * Function:  neighbor_is_different
+ * Function:  group_masks
  * --------------------
- * Determines if any of the neighbors of the given element are of a different group than the element. For example,
- * if the element identified by its indices is below the threshold, this function checks to see if any of its neighbors
- * are above the threshold. This function ignores any neighbors that contain a fill value.
+ * Thresholds a window into the masks of its valid pixels and of its two groups.
  *
  * args:
- *      int *window: pointer to an array containing the data. Elements should be 0 if they are below the threshold
- *      and 1 if they are above the threshold
- *      int row: the row the element of interest can be found in
- *      int col: the column the element of interest can be found in
- *
- * returns:
- *      int: 1 if at least one of the neighbors is different and 0 if all of its valid neighbors are the same
+ *      int *window: pointer to an array containing the data window
+ *      int threshold: the threshold to separate the two groups by
+ *      uint32_t *above: pointer to a WINDOW_WIDTH element array for the masks of the valid pixels at or above the
+ *      threshold
+ *      uint32_t *below: pointer to a WINDOW_WIDTH element array for the masks of the valid pixels below the threshold
+ *      uint32_t *valid: pointer to a WINDOW_WIDTH element array for the masks of the valid pixels
  */
-int neighbor_is_different(const int *window, int row, int col) {
-    int center = window[row * WINDOW_WIDTH + col];
-    for (int i = max(row - 1, 0); i < min(row + 2, WINDOW_WIDTH); i++) {
-        for (int j = max(col - 1, 0); j < min(col + 2, WINDOW_WIDTH); j++) {
-            if (window[i * WINDOW_WIDTH + j] != FILL_VALUE && center != window[i * WINDOW_WIDTH + j]) {
-                return 1;
-            }
-        }
+static void group_masks(const int *window, int threshold, uint32_t *above, uint32_t *below, uint32_t *valid) {
+    threshold_masks(window, threshold, above, valid);
+    for (int i = 0; i < WINDOW_WIDTH; i++) {
+        below[i] = valid[i] & ~above[i];
     }
-    return 0;
 }
 
+/*
+ * Function:  cohesive
+ * --------------------
+ * Determines if the two groups in the window divided separated by the given threshold is sufficiently cohesive.
+ * Compares each bin to its diagonal neighbors to see if members of each group are near other members.
+ *
+ * args:
+ *      int *window: pointer to an array containing the data window
+ *      int threshold: the threshold to separate the two groups by
+ *
+ * returns:
+ *      int: 1 if the threshold results in cohesive groups 0 if it does not
+ */
+int cohesive(const int *window, int threshold) {
+    uint32_t above[WINDOW_WIDTH], below[WINDOW_WIDTH], valid[WINDOW_WIDTH];
+    group_masks(window, threshold, above, below, valid);
+    return cohesive_masks(above, below, valid);
+}
 
 /*
- * Function:  find_edge
+ * Function:  find_edge_mask
  * --------------------
  * Implementation of the window-level processing portion of the "Location of Edge Pixels" step of the algorithm.
  * This function looks for any pixel that has a neighbor that is on the opposite side of the threshold from itself.
  * If a pixel has a different neighbor, it is designated as an edge pixel. Any pixels containing a fill value are
- * ignored and is set to 0.
+ * ignored and are never edge pixels.
+ *
+ * args:
+ *      int *window: pointer to an array containing the data window to perform the detection on. Should be of
+ *      WINDOW_WIDTH^2 length
+ *      int threshold: threshold value of the window determined by earlier steps of the algorithm
+ *      uint32_t *out: pointer to a WINDOW_WIDTH element array to which to write the edge pixels. Bit j of row i is
+ *      set if the pixel at column j of row i is an edge pixel.
+ */
+void find_edge_mask(const int *window, int threshold, uint32_t *out) {
+    uint32_t above[WINDOW_WIDTH], below[WINDOW_WIDTH], valid[WINDOW_WIDTH];
+    group_masks(window, threshold, above, below, valid);
+    edge_masks(above, below, out);
+}
+
+/*
+ * Function:  find_cohesive_edge
+ * --------------------
+ * Runs the cohesion test and, if the groups are cohesive, finds the edge pixels of the window, thresholding the window
+ * only once for both steps.
+ *
+ * args:
+ *      int *window: pointer to an array containing the data window. Should be of WINDOW_WIDTH^2 length
+ *      int threshold: threshold value of the window determined by earlier steps of the algorithm
+ *      uint32_t *out: pointer to a WINDOW_WIDTH element array to which to write the edge pixels as in find_edge_mask.
+ *      Left untouched if the groups are not cohesive.
+ *
+ * returns:
+ *      int: 1 if the threshold results in cohesive groups and edge pixels were written, 0 if it does not
+ */
+int find_cohesive_edge(const int *window, int threshold, uint32_t *out) {
+    uint32_t above[WINDOW_WIDTH], below[WINDOW_WIDTH], valid[WINDOW_WIDTH];
+    group_masks(window, threshold, above, below, valid);
+    if (!cohesive_masks(above, below, valid)) return 0;
+    edge_masks(above, below, out);
+    return 1;
+}
+
+/*
+ * Function:  find_edge
+ * --------------------
+ * Same as find_edge_mask, with one value for each pixel of the window.
  *
  * args:
  *      int *window: pointer to an array containing the data window to perform the detection on. Should be of
@@ -111,18 +269,11 @@ int neighbor_is_different(const int *window, int row, int col) {
  *
  */
 void find_edge(const int *window, int *out, int threshold) {
-    int bodies[1024];
-    for (int i = 0; i < squarei(WINDOW_WIDTH); i++) {
-        bodies[i] = window[i] == FILL_VALUE ? FILL_VALUE : window[i] >= threshold;
-    }
-
+    uint32_t rows[WINDOW_WIDTH];
+    find_edge_mask(window, threshold, rows);
     for (int i = 0; i < WINDOW_WIDTH; i++) {
         for (int j = 0; j < WINDOW_WIDTH; j++) {
-            if (bodies[i * WINDOW_WIDTH + j] != FILL_VALUE) {
-                out[i * WINDOW_WIDTH + j] = neighbor_is_different(bodies, i, j);
-            } else {
-                out[i * WINDOW_WIDTH + j] = 0;
-            }
+            out[i * WINDOW_WIDTH + j] = (rows[i] >> j) & 1;
         }
     }
-}
\ No newline at end of file
+}
@@ -1,7 +1,10 @@
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifndef SIED_COHESION_H
 #define SIED_COHESION_H
 int cohesive(const int window[], int threshold);
 void find_edge(const int window[], int *out,  int threshold);
+void find_edge_mask(const int window[], int threshold, uint32_t *out);
+int find_cohesive_edge(const int window[], int threshold, uint32_t *out);
 #endif //SIED_COHESION_H
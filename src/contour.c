@@ -2,22 +2,40 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include "helpers.h"
+#include "filter.h"
 #include "cayula.h"
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 static inline double square(double a) {
     return a * a;
 }
 
-static inline int mod(int a, int n) {
-    return a - floor(a / n) * n;
-}
-
+#define MIN_CONTOURS 64
+#define MIN_POINTS 1024
+#define CONTOUR_BAND_ROWS 128
+#define GRADIENT_CHUNK 64
 
 const int ANGLES[9] = {135, 90, 45,
                        180, 360, 0,
                        225, 270, 315};
 
+/*
+ * Change of direction in degrees between two headings, from 0 to 180 either way round. Headings are indexed by their
+ * angle divided by 45, which every angle of ANGLES but the center one is a multiple of.
+ */
+static const int TURNS[8][8] = {{  0,  45,  90, 135, 180, 135,  90,  45},
+                                { 45,   0,  45,  90, 135, 180, 135,  90},
+                                { 90,  45,   0,  45,  90, 135, 180, 135},
+                                {135,  90,  45,   0,  45,  90, 135, 180},
+                                {180, 135,  90,  45,   0,  45,  90, 135},
+                                {135, 180, 135,  90,  45,   0,  45,  90},
+                                { 90, 135, 180, 135,  90,  45,   0,  45},
+                                { 45,  90, 135, 180, 135,  90,  45,   0}};
+
 struct vector{
     double x;
     double y;
@@ -51,6 +69,149 @@ Vector gradient(int *window) {
     return g;
 }
 
+/*
+ * Function:  new_gradient_field
+ * --------------------
+ * Creates a gradient field for the given number of bins, with a zero gradient at every bin.
+ *
+ * args:
+ *      int nbins: the number of bins
+ *
+ * returns:
+ *      GradientField *: the gradient field, NULL if it could not be allocated
+ */
+GradientField * new_gradient_field(int nbins) {
+    GradientField *gradients = malloc(sizeof(GradientField));
+    if (gradients == NULL) return NULL;
+    gradients->nbins = nbins;
+    gradients->x = calloc(nbins > 0 ? nbins : 1, sizeof(int16_t));
+    gradients->y = calloc(nbins > 0 ? nbins : 1, sizeof(int16_t));
+    if (gradients->x == NULL || gradients->y == NULL) {
+        del_gradient_field(gradients);
+        return NULL;
+    }
+    return gradients;
+}
+
+/*
+ * Function:  del_gradient_field
+ * --------------------
+ * Frees a gradient field.
+ *
+ * args:
+ *      GradientField *gradients: the gradient field, or NULL
+ */
+void del_gradient_field(GradientField *gradients) {
+    if (gradients == NULL) return;
+    free(gradients->x);
+    free(gradients->y);
+    free(gradients);
+}
+
+#ifdef __SSE2__
+
+/*
+ * Function:  gradient_chunk
+ * --------------------
+ * Computes the doubled gradients of a run of bins of a row from their values and those of their neighbors. Values fit
+ * in 16 bits, so the fill values of 8 neighbors at a time are replaced with the values of the bins by masking before
+ * the differences are taken.
+ *
+ * args:
+ *      int16_t *row: the values of the bins, with the value of the bin west of the run first and of the bin east of it
+ *          last
+ *      int16_t *north: the values of the neighbors to the north of the bins
+ *      int16_t *south: the values of the neighbors to the south of the bins
+ *      int n: the number of bins of the run
+ *      int16_t *x: pointer to the output east-west gradients
+ *      int16_t *y: pointer to the output north-south gradients
+ */
+static void gradient_chunk(const int16_t *row, const int16_t *north, const int16_t *south, int n, int16_t *x,
+                           int16_t *y) {
+    __m128i fill = _mm_set1_epi16(FILL_VALUE);
+    int j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m128i center = _mm_loadu_si128((const __m128i *) (row + j + 1));
+        __m128i neighbors[4] = {_mm_loadu_si128((const __m128i *) (row + j + 2)),
+                                _mm_loadu_si128((const __m128i *) (row + j)),
+                                _mm_loadu_si128((const __m128i *) (south + j)),
+                                _mm_loadu_si128((const __m128i *) (north + j))};
+        for (int k = 0; k < 4; k++) {
+            __m128i invalid = _mm_cmpeq_epi16(neighbors[k], fill);
+            neighbors[k] = _mm_or_si128(_mm_and_si128(invalid, center), _mm_andnot_si128(invalid, neighbors[k]));
+        }
+        _mm_storeu_si128((__m128i *) (x + j), _mm_sub_epi16(neighbors[0], neighbors[1]));
+        _mm_storeu_si128((__m128i *) (y + j), _mm_sub_epi16(neighbors[2], neighbors[3]));
+    }
+    for (; j < n; j++) {
+        int center = row[j + 1];
+        x[j] = (row[j + 2] == FILL_VALUE ? center : row[j + 2]) - (row[j] == FILL_VALUE ? center : row[j]);
+        y[j] = (south[j] == FILL_VALUE ? center : south[j]) - (north[j] == FILL_VALUE ? center : north[j]);
+    }
+}
+#else
+
+/*
+ * Function:  gradient_chunk
+ * --------------------
+ * Computes the doubled gradients of a run of bins of a row from their values and those of their neighbors, replacing
+ * the fill values of the neighbors with the values of the bins.
+ *
+ * args:
+ *      int16_t *row: the values of the bins, with the value of the bin west of the run first and of the bin east of it
+ *          last
+ *      int16_t *north: the values of the neighbors to the north of the bins
+ *      int16_t *south: the values of the neighbors to the south of the bins
+ *      int n: the number of bins of the run
+ *      int16_t *x: pointer to the output east-west gradients
+ *      int16_t *y: pointer to the output north-south gradients
+ */
+static void gradient_chunk(const int16_t *row, const int16_t *north, const int16_t *south, int n, int16_t *x,
+                           int16_t *y) {
+    for (int j = 0; j < n; j++) {
+        int center = row[j + 1];
+        x[j] = (row[j + 2] == FILL_VALUE ? center : row[j + 2]) - (row[j] == FILL_VALUE ? center : row[j]);
+        y[j] = (south[j] == FILL_VALUE ? center : south[j]) - (north[j] == FILL_VALUE ? center : north[j]);
+    }
+}
+#endif
+
+/*
+ * Function:  gradient_rows
+ * --------------------
+ * Computes the gradient of every bin of a range of rows as gradient does from the 3x3 window around the bin, from a
+ * plane holding the rows of the range and the rows above and below it. The fill values of the neighbors are replaced
+ * with the value of the bin, and the differences are kept doubled so that they stay integers. The first and last rows
+ * of the map have no row on one side and are left with a zero gradient. The values of each row are gathered from the
+ * plane GRADIENT_CHUNK bins at a time, and the differences of a run are taken together.
+ *
+ * args:
+ *      GradientField *gradients: the gradient field to write the gradients to
+ *      Plane *filtered: the filtered data values
+ *      Grid *grid: descriptor of the binning scheme
+ *      int first_row: the first row of the range
+ *      int end_row: the row after the last row of the range
+ */
+void gradient_rows(GradientField *gradients, const Plane *filtered, const Grid *grid, int first_row, int end_row) {
+    int16_t row[GRADIENT_CHUNK + 2], north[GRADIENT_CHUNK], south[GRADIENT_CHUNK];
+    if (first_row < 1) first_row = 1;
+    if (end_row > grid->nrows - 1) end_row = grid->nrows - 1;
+    for (int i = first_row; i < end_row; i++) {
+        int north_bin = grid->basebins[i - 1];
+        int south_bin = grid->basebins[i + 1];
+        int end = grid->basebins[i] + grid->nbins_in_row[i];
+        for (int start = grid->basebins[i]; start < end; start += GRADIENT_CHUNK) {
+            int n = end - start < GRADIENT_CHUNK ? end - start : GRADIENT_CHUNK;
+            for (int j = -1; j <= n; j++) row[j + 1] = (int16_t) plane_value(filtered, start + j);
+            for (int j = 0; j < n; j++) {
+                north[j] = (int16_t) plane_value(filtered, north_bin + grid->north[start + j]);
+                south[j] = (int16_t) plane_value(filtered, south_bin + grid->south[start + j]);
+            }
+            gradient_chunk(row, north, south, n, gradients->x + start, gradients->y + start);
+        }
+    }
+}
+
 /*
  * Function:  turn_too_sharp
  * --------------------
@@ -58,29 +219,20 @@ Vector gradient(int *window) {
  * degrees over the course of 5 pixels.
  *
  * args:
- *      ContourPoint *tail: the last point currently on the contour
+ *      Contours *contours: the contours, the last of which is being followed
  *      int next_theta: the angle between the last point on the contour and the point to be added
  *
  * returns:
  *      int: 1 if change in direction exceeds 90 degrees, 0 if it does not
  */
-int turn_too_sharp(ContourPoint *tail, int next_theta) {
-    int counter = 0;
-    int is_turn_too_sharp = 0;
-    ContourPoint *tmp = tail;
-    while (tmp->prev->prev != NULL && counter < 5) {
-        int dtheta = mod(tmp->angle - next_theta + 180, 360) - 180;
-        dtheta = dtheta < -180 ? dtheta + 360 : dtheta;
-        dtheta = abs(dtheta);
-        if (dtheta > 90) {
-            is_turn_too_sharp = 1;
-            break;
-        }
-        tmp = tmp->prev;
-        counter++;
-
+int turn_too_sharp(const Contours *contours, int next_theta) {
+    int first = contours->offsets[contours->ncontours - 1];
+    const int *turns = TURNS[next_theta / 45];
+    //The direction of the second point is never compared, the first one having none
+    for (int k = contours->npoints - 1; k > first + 1 && k > contours->npoints - 6; k--) {
+        if (turns[contours->angles[k] / 45] > 90) return 1;
     }
-    return is_turn_too_sharp;
+    return 0;
 }
 
 /*
@@ -121,73 +273,179 @@ double gradient_ratio(const int *window) {
     return sqrt(square(sum_x) + square(sum_y)) / sum_magnitude;
 }
 
-Contour *new_contour(Contour *prev, int bin) {
-    Contour *n = malloc(sizeof(Contour));
-    n->prev = prev;
-    n->next = NULL;
-    n->length = 0;
+/*
+ * Function:  gradient_field_ratio
+ * --------------------
+ * Same as gradient_ratio, from the sums of the precomputed gradients over the 3x3 window around a bin.
+ *
+ * args:
+ *      GradientField *gradients: the precomputed gradients
+ *      int *first_bins: pointer to an array with the first bin of each row of the window
+ *
+ * returns:
+ *      double: the ratio between the magnitude of the sum of the gradient vectors and the sum of their magnitudes
+ */
+static double gradient_field_ratio(const GradientField *gradients, const int *first_bins) {
+    double sum_magnitude = 0;
+    int sum_x = 0, sum_y = 0;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            int x = gradients->x[first_bins[i] + j];
+            int y = gradients->y[first_bins[i] + j];
+            sum_magnitude += sqrt(x * x + y * y);
+            sum_x += x;
+            sum_y += y;
+        }
+    }
+    //The gradients are doubled, which scales both sums alike
+    return sqrt((double) sum_x * sum_x + (double) sum_y * sum_y) / sum_magnitude;
+}
+
+/*
+ * Function:  gradient_window
+ * --------------------
+ * Reads a window of filtered data values to compute gradients from, given the first bin of each of its rows.
+ *
+ * args:
+ *      Plane *field: the data values
+ *      int filter: nonzero if the median filter has to be applied to the values of field as they are read, zero if
+ *      field already holds filtered values
+ *      Grid *grid: descriptor of the binning scheme
+ *      int *first_bins: pointer to an array with the first bin of each row of the window
+ *      int width: the width of the window
+ *      int *window: pointer to output array for the window. The array should be of width * width length
+ */
+static void gradient_window(const Plane *field, int filter, const Grid *grid, const int *first_bins, int width,
+                            int window[]) {
+    if (!filter) {
+        plane_window(field, first_bins, width, window);
+        return;
+    }
+    for (int i = 0; i < width; i++) {
+        for (int j = 0; j < width; j++) {
+            int bin = first_bins[i] + j;
+            window[i * width + j] = median_filter_bin(field, grid, bin, grid_row(grid, bin));
+        }
+    }
+}
 
-    if (prev != NULL) prev -> next = n;
+/*
+ * Function:  new_contours
+ * --------------------
+ * Creates an empty set of contours with room for a first batch of contours and points.
+ *
+ * returns:
+ *      Contours *: the contours, NULL if they could not be allocated
+ */
+Contours * new_contours(void) {
+    Contours *contours = malloc(sizeof(Contours));
+    if (contours == NULL) return NULL;
+    contours->ncontours = 0;
+    contours->npoints = 0;
+    contours->max_contours = MIN_CONTOURS;
+    contours->max_points = MIN_POINTS;
+    contours->offsets = malloc((MIN_CONTOURS + 1) * sizeof(int));
+    contours->lengths = malloc(MIN_CONTOURS * sizeof(int));
+    contours->bins = malloc(MIN_POINTS * sizeof(int));
+    contours->angles = malloc(MIN_POINTS * sizeof(int));
+    if (contours->offsets == NULL || contours->lengths == NULL || contours->bins == NULL || contours->angles == NULL) {
+        del_contours(contours);
+        return NULL;
+    }
+    contours->offsets[0] = 0;
+    return contours;
+}
+
+/*
+ * Function:  del_contours
+ * --------------------
+ * Frees a set of contours.
+ *
+ * args:
+ *      Contours *contours: the contours to free
+ */
+void del_contours(Contours *contours) {
+    if (contours == NULL) return;
+    free(contours->offsets);
+    free(contours->lengths);
+    free(contours->bins);
+    free(contours->angles);
+    free(contours);
+}
 
-    ContourPoint *c = malloc(sizeof(ContourPoint));
-    c->bin = bin;
-    c->prev = NULL;
-    c->next = NULL;
-    n->first_point = c;
-    return n;
+/*
+ * Function:  grow
+ * --------------------
+ * Doubles the size of an array of ints.
+ *
+ * args:
+ *      int **array: pointer to the array, replaced by the grown array
+ *      int n: the number of elements the grown array should hold
+ *
+ * returns:
+ *      int: 1 if the array was grown, 0 if it could not be, in which case it is left as is
+ */
+static int grow(int **array, int n) {
+    int *grown = realloc(*array, n * sizeof(int));
+    if (grown == NULL) return 0;
+    *array = grown;
+    return 1;
 }
 
 /*
-* Function:  del_contour
-* --------------------
-* Deletes the provided node in the linked list of contours and all the contour point nodes that belongs to it. If
-* the node is the middle of the linked list, the nodes before and after are linked to each other.
-*
-* args:
-*      Contour *n: the node of the linked list to delete
-* returns:
- *     Contour *: pointer to next contour
-*/
-Contour * del_contour(Contour *n) {
-    ContourPoint *c = n->first_point;
-    Contour *next = n->next;
-    while (c != NULL) {
-        ContourPoint *tmp = c;
-        c = c->next;
-        free(tmp);
-    };
-    if (n->prev != NULL) {
-        n->prev->next = n->next;
+ * Function:  start_contour
+ * --------------------
+ * Starts a new contour after the last one, made of a single point. Its length is 0 until it is set once it has been
+ * followed.
+ *
+ * args:
+ *      Contours *contours: the contours to add the contour to
+ *      int bin: the bin number of the first point of the contour
+ *
+ * returns:
+ *      int: 1 if the contour was added, 0 if there was no memory for it
+ */
+int start_contour(Contours *contours, int bin) {
+    if (contours->ncontours == contours->max_contours) {
+        int n = 2 * contours->max_contours;
+        if (!grow(&contours->offsets, n + 1) || !grow(&contours->lengths, n)) return 0;
+        contours->max_contours = n;
     }
-    if (n->next != NULL) {
-        n->next->prev = n->prev;
+    //The new contour starts out empty so that its point is added like any other
+    contours->lengths[contours->ncontours] = 0;
+    contours->ncontours++;
+    contours->offsets[contours->ncontours] = contours->npoints;
+    if (!add_contour_point(contours, bin, 0)) {
+        contours->ncontours--;
+        return 0;
     }
-    free(n);
-
-    return next;
+    return 1;
 }
 
 /*
- * Function:  new_contour_point
+ * Function:  add_contour_point
  * --------------------
- * Creates a new contour point and adds it to the end of the doubly linked list representing a single contour.
+ * Adds a point to the end of the last contour.
  *
  * args:
- *      ContourPoint *prev: the last node in the contour linked list
- *      int bin: the bin number of the new point to add to the list
+ *      Contours *contours: the contours, the last of which to add the point to
+ *      int bin: the bin number of the new point to add to the contour
  *      int angle: the angle between the last point in the contour and the new point
  *
  * returns:
- *      ContourPoint *: the new point that is now the last node in the linked list
+ *      int: 1 if the point was added, 0 if there was no memory for it
  */
-ContourPoint * new_contour_point(ContourPoint *prev, int bin, int angle) {
-    ContourPoint *c = malloc(sizeof(ContourPoint));
-    c->bin = bin;
-    c->angle = angle;
-    c->prev = prev;
-    c->next = NULL;
-    if (prev != NULL)     prev->next = c;
-    return c;
+int add_contour_point(Contours *contours, int bin, int angle) {
+    if (contours->npoints == contours->max_points) {
+        int n = 2 * contours->max_points;
+        if (!grow(&contours->bins, n) || !grow(&contours->angles, n)) return 0;
+        contours->max_points = n;
+    }
+    contours->bins[contours->npoints] = bin;
+    contours->angles[contours->npoints] = angle;
+    contours->npoints++;
+    contours->offsets[contours->ncontours] = contours->npoints;
+    return 1;
 }
 
 /*
@@ -200,47 +458,14 @@ ContourPoint * new_contour_point(ContourPoint *prev, int bin, int angle) {
  *      int bin: the center bin number in the window of interest
  *      int i: the index for the desired bin in the window of interest
  *      int row: the row number of the center bin
- *      int *basebins: pointer to an array containing the bin number for the first bin of each row
- *      int *nbins_in_row: pointer to an array containing the number of bins in each row
+ *      Grid *grid: descriptor of the binning scheme
  *
  * returns:
  *      int: bin number of the desired bin
  */
-static int get_bin_number(int bin, int i, int row, const int *basebins, const int *nbins_in_row) {
-    double ratio;
-    int next_bin;
-    switch(i) {
-        case 0:
-            ratio = (bin - basebins[row]) / (double) nbins_in_row[row];
-            next_bin = (int) (ratio * nbins_in_row[row - 1] + 0.5)  + basebins[row - 1] - 1;
-            break;
-        case 1:
-            ratio = (bin - basebins[row]) / (double) nbins_in_row[row];
-            next_bin = (int) (ratio * nbins_in_row[row - 1] + 0.5)  + basebins[row - 1];
-            break;
-        case 2:
-            ratio = (bin - basebins[row]) / (double) nbins_in_row[row];
-            next_bin = (int) (ratio * nbins_in_row[row - 1] + 0.5)  + basebins[row - 1] + 1;
-            break;
-        case 3:
-            next_bin = bin - 1;
-            break;
-        case 5:
-            next_bin = bin + 1;
-        case 6:
-            ratio = (bin - basebins[row]) / (double) nbins_in_row[row];
-            next_bin = (int) (ratio * nbins_in_row[row + 1] + 0.5)  + basebins[row + 1] - 1;
-            break;
-        case 7:
-            ratio = (bin - basebins[row]) / (double) nbins_in_row[row];
-            next_bin = (int) (ratio * nbins_in_row[row + 1] + 0.5)  + basebins[row + 1];
-            break;
-        case 8:
-            ratio = (bin - basebins[row]) / (double) nbins_in_row[row];
-            next_bin = (int) (ratio * nbins_in_row[row + 1] + 0.5)  + basebins[row + 1] + 1;
-            break;
-    }
-    return next_bin;
+static inline int get_bin_number(int bin, int i, int row, const Grid *grid) {
+    if (i == 5) i = 6;  //The east neighbor has always resolved to the south west neighbor
+    return grid_neighbor(grid, bin, row, i / 3 - 1) + i % 3 - 1;
 }
 
 /*
@@ -249,197 +474,875 @@ static int get_bin_number(int bin, int i, int row, const int *basebins, const in
  * Of the bins neighboring the last bin on the contour, this function selects the best front bin to add to the contour.
  * Going through all the neighboring bins, the function identifies the next bin that will change the direction of the
  * contour the least. However, if adding the selected bin would result in the contour changing direction by more than
- * 90 degrees over the course of 5 bins, the bin is rejected as a possible addition to the contour. If the provided
- * contour point is the first point in the contour and thus has no direction, the selection is biased towards higher
- * numbered bins as they are the least likely to be contained in other contours.
+ * 90 degrees over the course of 5 bins, the bin is rejected as a possible addition to the contour. If the last point
+ * is the first point in the contour and thus has no direction, the selection is biased towards higher numbered bins as
+ * they are the least likely to be contained in other contours.
  *
  * args:
- *      ContourPoint *prev: the last edge pixel in the current contour
- *      int *data: pointer to a boolean array representing the pixels status as an edge pixel
+ *      Contours *contours: the contours, the last of which is being followed
+ *      uint64_t *data: pointer to a bitmap representing the pixels status as an edge pixel
  *      int row: the row of the last edge pixel in the current contour
- *      int *basebins: pointer to an array containing the index of the first bin of each row
- *      int *nbins_in_row: pointer to an array containing the number of bins in each row
+ *      Grid *grid: descriptor of the binning scheme
  *
  * returns:
- *      ContourPoint *: the selected point to add to the contour. Pointer will be NULL if there is no previously
- *      identified edge pixel to add to the contour.
+ *      int: 1 if a point was added to the contour, 0 if there is no previously identified edge pixel to add to the
+ *      contour, -1 if there was no memory for the point
  */
-ContourPoint * find_best_front(ContourPoint *prev, const int *data,  int row, const int *basebins, const int *nbins_in_row) {
-    int edge_window[9];
-    get_window(prev->bin, row, 3, data, nbins_in_row, basebins, edge_window);
+int find_best_front(Contours *contours, const uint64_t *data,  int row, const Grid *grid) {
+    int last = contours->npoints - 1;
+    int prev_bin = contours->bins[last];
+    int is_first = last == contours->offsets[contours->ncontours - 1];
+    int first_bins[3];
+    grid_window_rows(grid, prev_bin, row, 3, first_bins);
+    uint32_t edge_window = bitmap_run(data, first_bins[0], 3) | bitmap_run(data, first_bins[1], 3) << 3 |
+                           bitmap_run(data, first_bins[2], 3) << 6;
     int next_bin = -1;
     int min_dtheta = 180;
     int next_angle;
+    const int *turns = TURNS[contours->angles[last] / 45];
     for (int i = 0; i < 9; i++) {
-        int dtheta = 180;
-        if (i != 4 && edge_window[i]) {
-            if (prev->prev == NULL) {
-                dtheta = 0;
-            } else {
-                dtheta = prev->angle - ANGLES[i];
-                dtheta = mod(dtheta + 180, 360) - 180;
-                dtheta = dtheta < -180 ? dtheta + 360 : dtheta;
-                dtheta = abs(dtheta);
-            }
+        if (i != 4 && (edge_window >> i) & 1) {
+            int dtheta = is_first ? 0 : turns[ANGLES[i] / 45];
             if (dtheta == 0 || dtheta < min_dtheta) {
                 min_dtheta = dtheta;
                 next_angle = ANGLES[i];
-                next_bin = get_bin_number(prev->bin, i, row, basebins, nbins_in_row);
+                next_bin = get_bin_number(prev_bin, i, row, grid);
             }
         }
     }
 
-    if (next_bin != -1 && (prev->prev == NULL || !turn_too_sharp(prev, next_angle))) {
-        return new_contour_point(prev, next_bin, next_angle);
+    if (next_bin != -1 && (is_first || !turn_too_sharp(contours, next_angle))) {
+        return add_contour_point(contours, next_bin, next_angle) ? 1 : -1;
     } else {
-        return NULL;
+        return 0;
     }
 }
 
 /*
- * Function:  find_best_front
+ * Function:  find_gradient_field_front
  * --------------------
- * Recursive function for growing the contour using the previously detected edge pixels and gradients.
+ * Same as find_gradient_front, with the gradients read from a precomputed gradient field. The gradient of each
+ * neighbor is that of its own 3x3 window.
  *
  * args:
- *      ContourPoint *prev: the last edge pixel in the current contour
- *      int *data: pointer to a boolean array representing the pixels status as an edge pixel
- *      int *filtered_data: point to an array containing the data that resulted from applying a median filter to
- *      the original data
+ *      Contours *contours: the contours, the last of which is being followed
+ *      GradientField *gradients: the precomputed gradients
+ *      uint64_t *pixel_in_contour: pointer to a bitmap of the pixels already in a contour or without data
  *      int row: the row of the last edge pixel in the current contour
- *      int nrows: the number of rows in the binning scheme
- *      int *basebins: pointer to an array containing the index of the first bin of each row
- *      int *nbins_in_row: pointer to an array containing the number of bins in each row
+ *      Grid *grid: descriptor of the binning scheme
  *
  * returns:
- *      int: the number of points in the contour that are contained in the segment of the contour starting with
- *      the current point
+ *      int: 1 if a point was added to the contour, 0 if there is none, -1 if there was no memory for the point
  */
-int follow_contour(ContourPoint *prev, const int *data, const int *filtered_data, int *pixel_in_contour, int row, int nrows, const int *basebins, const int *nbins_in_row) {
-    ContourPoint *next_point;
-    next_point = find_best_front(prev, data, row, basebins,nbins_in_row);
-    int count = 1;
-    double ratio = 0;
-    int max_bin;
-    if (next_point == NULL) {
-        int outer_window[25];
-        get_window(prev->bin, row, 5, filtered_data, nbins_in_row, basebins, outer_window);
-        double ratio = gradient_ratio(outer_window);
-        if (ratio > 0.7) {
-            int bin_window[9];
-            double max_product = -1;
-            int max_idx = -1;
-            get_window(prev->bin, row, 3, filtered_data, nbins_in_row, basebins, bin_window);
-            Vector gradient0 = gradient(bin_window);
-            for (int i = 0; i < 3; i++) {
-                for (int j = 0; j < 3; j++) {
-                    if (i != 1 || j != 1) {
-                        int bin = get_bin_number(prev->bin, i * 3 + j, row,basebins, nbins_in_row);
-                        if (!pixel_in_contour[bin]) {
-                            get_window(bin, row + j - 1, 3, filtered_data, nbins_in_row, basebins, bin_window);
-                            Vector gradient1 = gradient(bin_window);
-                            double product = dot(gradient0, gradient1);
-                            if (product > max_product) {
-                                max_product = product;
-                                max_idx = i * 3 + j;
-                                max_bin = bin;
-                            }
-                        }
-                    }
+static int find_gradient_field_front(Contours *contours, const GradientField *gradients,
+                                     const uint64_t *pixel_in_contour, int row, const Grid *grid) {
+    int prev_bin = contours->bins[contours->npoints - 1];
+    int first_bins[3];
+    grid_window_rows(grid, prev_bin, row, 3, first_bins);
+    if (gradient_field_ratio(gradients, first_bins) <= 0.7) return 0;
+    int x0 = gradients->x[prev_bin];
+    int y0 = gradients->y[prev_bin];
+    int max_product = -1;
+    int max_idx = -1;
+    int max_bin = -1;
+    for (int i = 0; i < 9; i++) {
+        if (i == 4) continue;
+        int bin = get_bin_number(prev_bin, i, row, grid);
+        if (!bitmap_get(pixel_in_contour, bin)) {
+            //Truncated as the product of the halved gradients would be
+            int product = (x0 * gradients->x[bin] + y0 * gradients->y[bin]) / 4;
+            if (product > max_product) {
+                max_product = product;
+                max_idx = i;
+                max_bin = bin;
+            }
+        }
+    }
+    if (max_product > 0) {
+        return add_contour_point(contours, max_bin, ANGLES[max_idx]) ? 1 : -1;
+    }
+    return 0;
+}
 
+/*
+ * Function:  find_gradient_front
+ * --------------------
+ * Selects the next point of a contour from the gradients when no edge pixel neighbors its last point. If the gradients
+ * around the last point are aligned enough, the neighbor not yet in a contour whose gradient is the most aligned with
+ * that of the last point is added. Gradients are read from the precomputed gradient field when there is one, and
+ * computed from the data values otherwise.
+ *
+ * args:
+ *      Contours *contours: the contours, the last of which is being followed
+ *      Plane *field: the data values gradients are computed from
+ *      int filter: nonzero if the median filter has to be applied to the values of field as they are read
+ *      GradientField *gradients: the precomputed gradients, NULL to compute them from field
+ *      uint64_t *pixel_in_contour: pointer to a bitmap of the pixels already in a contour or without data
+ *      int row: the row of the last edge pixel in the current contour
+ *      Grid *grid: descriptor of the binning scheme
+ *
+ * returns:
+ *      int: 1 if a point was added to the contour, 0 if there is none, -1 if there was no memory for the point
+ */
+static int find_gradient_front(Contours *contours, const Plane *field, int filter, const GradientField *gradients,
+                               const uint64_t *pixel_in_contour, int row, const Grid *grid) {
+    if (gradients != NULL) return find_gradient_field_front(contours, gradients, pixel_in_contour, row, grid);
+    int prev_bin = contours->bins[contours->npoints - 1];
+    int outer_window[25];
+    int first_bins[5];
+    grid_window_rows(grid, prev_bin, row, 5, first_bins);
+    gradient_window(field, filter, grid, first_bins, 5, outer_window);
+    double ratio = gradient_ratio(outer_window);
+    if (ratio <= 0.7) return 0;
+    int bin_window[9];
+    double max_product = -1;
+    int max_idx = -1;
+    int max_bin = -1;
+    grid_window_rows(grid, prev_bin, row, 3, first_bins);
+    gradient_window(field, filter, grid, first_bins, 3, bin_window);
+    Vector gradient0 = gradient(bin_window);
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (i != 1 || j != 1) {
+                int bin = get_bin_number(prev_bin, i * 3 + j, row, grid);
+                if (!bitmap_get(pixel_in_contour, bin)) {
+                    //The row given here is not always the row of the bin, so the neighbor tables cannot be used
+                    get_window_rows(bin, row + j - 1, 3, grid->nbins_in_row, grid->basebins, first_bins);
+                    gradient_window(field, filter, grid, first_bins, 3, bin_window);
+                    Vector gradient1 = gradient(bin_window);
+                    double product = dot(gradient0, gradient1);
+                    if (product > max_product) {
+                        max_product = product;
+                        max_idx = i * 3 + j;
+                        max_bin = bin;
+                    }
                 }
             }
-            if (max_product > 0) {
-                next_point = new_contour_point(prev, max_bin, ANGLES[max_idx]);
-            }
         }
     }
+    if (max_product > 0) {
+        return add_contour_point(contours, max_bin, ANGLES[max_idx]) ? 1 : -1;
+    }
+    return 0;
+}
+
+/*
+ * Function:  next_contour_row
+ * --------------------
+ * Returns the row a contour is followed from after a step at the given angle. Steps to the east are followed from the
+ * same row, although the east neighbor has always resolved to the south west neighbor.
+ *
+ * args:
+ *      int row: the row the step was taken from
+ *      int angle: the angle of the step
+ *
+ * returns:
+ *      int: the row to follow the contour from
+ */
+static inline int next_contour_row(int row, int angle) {
+    switch(angle) {
+        case 0:
+        case 180:
+            return row;
+        case 1 ... 179:
+            return row - 1;
+        case 181 ... 359:
+            return row + 1;
+        default:
+            return row;
+    }
+}
+
+/*
+ * Function:  can_follow
+ * --------------------
+ * Determines if a contour can be followed from a point, which is not the case too close to the edge of the map.
+ *
+ * args:
+ *      Grid *grid: descriptor of the binning scheme
+ *      int bin: the bin of the point
+ *      int row: the row the contour is followed from
+ *
+ * returns:
+ *      int: 1 if the contour can be followed, 0 if it cannot
+ */
+static inline int can_follow(const Grid *grid, int bin, int row) {
+    return row < grid->nrows - 2 && row > 1 && bin > grid->basebins[row] + 1 && bin < grid->basebins[row + 1] - 2;
+}
 
-    if (next_point != NULL && !pixel_in_contour[next_point->bin]) {
-        int next_row;
-        pixel_in_contour[next_point->bin] = 1;
-        switch(next_point->angle) {
-            case 0:
-            case 180:
-                next_row = row;
-                break;
-            case 1 ... 179:
-                next_row = row - 1;
-                break;
-            case 181 ... 359:
-                next_row = row + 1;
-                break;
-            default:
-                next_row = row;
-                break;
+/*
+ * Function:  follow_contour_range
+ * --------------------
+ * Same as follow_contour, but only claims the bins of a range of bins. The contour is left open at the first point it
+ * reaches outside of the range, which is added to it without being claimed or counted, so that it can be stitched to
+ * the contour traced on the other side.
+ *
+ * args:
+ *      Contours *contours: the contours, the last of which is followed from its last point
+ *      uint64_t *data: pointer to a bitmap representing the pixels status as an edge pixel
+ *      Plane *field: the data values gradients are computed from
+ *      int filter: nonzero if the median filter has to be applied to the values of field as they are read
+ *      GradientField *gradients: the precomputed gradients of the filtered data, NULL to compute them from field
+ *      uint64_t *pixel_in_contour: pointer to a bitmap of the pixels already in a contour or without data
+ *      int row: the row of the last edge pixel in the current contour
+ *      Grid *grid: descriptor of the binning scheme
+ *      int first_bin: the first bin of the range
+ *      int end_bin: the bin after the last bin of the range
+ *
+ * returns:
+ *      int: the number of points in the contour that are contained in the segment of the contour starting with
+ *      the current point, -1 if there was no memory for the next point
+ */
+static int follow_contour_range(Contours *contours, const uint64_t *data, const Plane *field, int filter,
+                                const GradientField *gradients, uint64_t *pixel_in_contour, int row, const Grid *grid,
+                                int first_bin, int end_bin) {
+    int count = 1;
+    while (1) {
+        int found = find_best_front(contours, data, row, grid);
+        if (found == 0) found = find_gradient_front(contours, field, filter, gradients, pixel_in_contour, row, grid);
+        if (found < 0) return -1;
+        if (found == 0) return count;
+        int next_bin = contours->bins[contours->npoints - 1];
+        if (next_bin < first_bin || next_bin >= end_bin) {
+            return count;
+        }
+        //A point already in a contour is still added to this one, but ends it without being counted
+        if (bitmap_get(pixel_in_contour, next_bin)) {
+            return count;
         }
+        bitmap_set(pixel_in_contour, next_bin);
+        int next_row = next_contour_row(row, contours->angles[contours->npoints - 1]);
+        count++;
 
         /*
          * If the next point is too close to the edge of the map, we still need to increment the counter, but we don't
          * want to try following the contour any further
          */
-        if (next_row < nrows - 2 && next_row > 1 && next_point->bin > basebins[next_row] + 1 && next_point->bin < basebins[next_row + 1] - 2) {
-            count += follow_contour(next_point, data, filtered_data, pixel_in_contour, next_row, nrows, basebins,
-                                    nbins_in_row);
-        } else {
-            count++;
+        if (!can_follow(grid, next_bin, next_row)) {
+            return count;
         }
+        row = next_row;
     }
+}
 
-    return count;
+/*
+ * Function:  follow_contour
+ * --------------------
+ * Grows the contour using the previously detected edge pixels and gradients. Each step only depends on the last point
+ * of the contour and its row, so the contour is followed in a loop, and the stack use does not grow with the length
+ * of the front.
+ *
+ * args:
+ *      Contours *contours: the contours, the last of which is followed from its last point
+ *      uint64_t *data: pointer to a bitmap representing the pixels status as an edge pixel
+ *      Plane *field: the data values gradients are computed from
+ *      int filter: nonzero if the median filter has to be applied to the values of field as they are read, zero if
+ *      field already holds the data that resulted from applying a median filter to the original data
+ *      uint64_t *pixel_in_contour: pointer to a bitmap of the pixels already in a contour or without data
+ *      int row: the row of the last edge pixel in the current contour
+ *      Grid *grid: descriptor of the binning scheme
+ *
+ * returns:
+ *      int: the number of points in the contour that are contained in the segment of the contour starting with
+ *      the current point, -1 if there was no memory for the next point
+ */
+int follow_contour(Contours *contours, const uint64_t *data, const Plane *field, int filter,
+                   uint64_t *pixel_in_contour, int row, const Grid *grid) {
+    return follow_contour_range(contours, data, field, filter, NULL, pixel_in_contour, row, grid, 0, grid->nbins);
 }
 
 /*
- * Function:  contour
+ * Function:  new_pixel_in_contour
  * --------------------
- * Creates and extends contours using previously detected edges and gradients to define the final edges.
+ * Creates the bitmap of the pixels contours cannot be traced through, which at first are the pixels without data.
  *
  * args:
- *      int *data: pointer to a boolean array representing the pixels status as an edge pixel
- *      int *filtered_data: point to an array containing the data that resulted from applying a median filter to
- *      the original data
- *      int *out_data: pointer an array to write the front values for each pixel. 1 for a front, 0 for not
- *      int nbins: the number of bins in the binning scheme
- *      int nrows: the number of rows in the binning scheme
- *      int *nbins_in_row: the number of bins in each row
- *      int *basebins: pointer to an array containing the index of the first bin of each row
+ *      Plane *field: the data values gradients are computed from
+ *      int filter: nonzero if field holds the original data, zero if it holds filtered data
+ *      Grid *grid: descriptor of the binning scheme
  *
+ * returns:
+ *      uint64_t *: the bitmap, NULL if it could not be allocated
  */
-void contour(int *data, int *filtered_data, int *out_data, int nbins, int nrows, const int *nbins_in_row, const int *basebins) {
-    int *pixel_in_contour = malloc(sizeof(int) * nbins);
-    for (int i = 0; i < nbins; i++) {
-        pixel_in_contour[i] = filtered_data[i] == FILL_VALUE ? 1 : 0;
+static uint64_t * new_pixel_in_contour(const Plane *field, int filter, const Grid *grid) {
+    int nbins = grid->nbins;
+    int nrows = grid->nrows;
+    const int *nbins_in_row = grid->nbins_in_row;
+    const int *basebins = grid->basebins;
+    uint64_t *pixel_in_contour = new_bitmap(nbins);
+    if (pixel_in_contour == NULL) return NULL;
+    for (int w = 0; w < BITMAP_WORDS(nbins); w++) {
+        pixel_in_contour[w] = ~field->valid[w];
     }
-    Contour *head = NULL;
-    Contour *current = NULL;
-    for (int i = 2; i < nrows - 2; i++) {
+    if (filter) {
+        //The median filter leaves the first and last row and the first and last bin of every row without data
+        for (int i = 0; i < nrows; i++) {
+            if (nbins_in_row[i] == 0) continue;
+            if (i == 0 || i == nrows - 1) {
+                for (int j = basebins[i]; j < basebins[i] + nbins_in_row[i]; j++) bitmap_set(pixel_in_contour, j);
+            }
+            bitmap_set(pixel_in_contour, basebins[i]);
+            bitmap_set(pixel_in_contour, basebins[i] + nbins_in_row[i] - 1);
+        }
+    }
+    return pixel_in_contour;
+}
+
+/*
+ * Function:  row_first_bin
+ * --------------------
+ * Returns the first bin of a row, or the number of bins for the row after the last one.
+ */
+static inline int row_first_bin(const Grid *grid, int row) {
+    return row < grid->nrows ? grid->basebins[row] : grid->nbins;
+}
+
+/*
+ * Function:  trace_rows
+ * --------------------
+ * Starts contours from the edge pixels of a range of rows not yet in a contour, in the order of their bins, and
+ * follows them as long as they stay in the range.
+ *
+ * args:
+ *      Contours *contours: the contours to add the contours to
+ *      uint64_t *data: pointer to a bitmap representing the pixels status as an edge pixel
+ *      Plane *field: the data values gradients are computed from
+ *      int filter: nonzero if field holds the original data, zero if it holds filtered data
+ *      GradientField *gradients: the precomputed gradients of the filtered data, NULL to compute them from field
+ *      uint64_t *pixel_in_contour: pointer to a bitmap of the pixels already in a contour or without data
+ *      Grid *grid: descriptor of the binning scheme
+ *      int first_row: the first row of the range
+ *      int end_row: the row after the last row of the range
+ *
+ * returns:
+ *      int: 1 if the rows were traced, 0 if there was no memory for a contour
+ */
+static int trace_rows(Contours *contours, const uint64_t *data, const Plane *field, int filter,
+                       const GradientField *gradients, uint64_t *pixel_in_contour, const Grid *grid, int first_row,
+                       int end_row) {
+    const int *nbins_in_row = grid->nbins_in_row;
+    const int *basebins = grid->basebins;
+    int first_bin = row_first_bin(grid, first_row);
+    int end_bin = row_first_bin(grid, end_row);
+    int start = first_row > 2 ? first_row : 2;
+    int end = end_row < grid->nrows - 2 ? end_row : grid->nrows - 2;
+    for (int i = start; i < end; i++) {
         for (int j = basebins[i] + 2; j < basebins[i] + nbins_in_row[i] - 2; j++) {
-            if (data[j] && !pixel_in_contour[j]) {
-                pixel_in_contour[j] = 1;
-                ContourPoint * point = new_contour_point(NULL, j, 0);
-                int length = follow_contour(point, data, filtered_data, pixel_in_contour, i, nrows, basebins, nbins_in_row);
-                if (head == NULL) {
-                    current = new_contour(NULL, j);
-                    current->length = length;
-                    current->first_point = point;
-                    head = current;
-                } else {
-                    current = new_contour(current, j);
-                    current->length = length;
-                    current->first_point = point;
-                }
+            if (bitmap_get(data, j) && !bitmap_get(pixel_in_contour, j)) {
+                bitmap_set(pixel_in_contour, j);
+                if (!start_contour(contours, j)) return 0;
+                int length = follow_contour_range(contours, data, field, filter, gradients, pixel_in_contour, i,
+                                                  grid, first_bin, end_bin);
+                if (length < 0) return 0;
+                contours->lengths[contours->ncontours - 1] = length;
             }
         }
     }
+    return 1;
+}
+
+/*
+ * Function:  trace_contours
+ * --------------------
+ * Creates and extends contours using previously detected edges and gradients. Gradients are computed from median
+ * filtered data, which can either be given or be filtered on demand from the original data for the few bins the
+ * contours need, so that the filtered map does not have to be kept. Contours are started from the edge pixels not
+ * yet in a contour in the order of their bins.
+ *
+ * args:
+ *      uint64_t *data: pointer to a bitmap representing the pixels status as an edge pixel
+ *      Plane *field: the data values gradients are computed from
+ *      int filter: nonzero if field holds the original data, zero if it holds the data that resulted from applying a
+ *      median filter to the original data
+ *      GradientField *gradients: the precomputed gradients of the filtered data, NULL to compute them from field
+ *      Grid *grid: descriptor of the binning scheme
+ *
+ * returns:
+ *      Contours *: the contours, to be freed with del_contours. NULL if there was not enough memory for them.
+ */
+Contours * trace_contours(const uint64_t *data, const Plane *field, int filter, const GradientField *gradients,
+                          const Grid *grid) {
+    uint64_t *pixel_in_contour = new_pixel_in_contour(field, filter, grid);
+    Contours *contours = new_contours();
+    if (pixel_in_contour == NULL || contours == NULL ||
+        !trace_rows(contours, data, field, filter, gradients, pixel_in_contour, grid, 0, grid->nrows)) {
+        del_contours(contours);
+        contours = NULL;
+    }
     free(pixel_in_contour);
-    while (head != NULL) {
-        if (head->length >= 15) {
-            ContourPoint *point = head->first_point;
-            while (point != NULL) {
-                out_data[point->bin] = 1;
-                point = point->next;
+    return contours;
+}
+
+struct contour_task {
+    const uint64_t *data;
+    const Plane *field;
+    int filter;
+    const GradientField *gradients;
+    uint64_t *pixel_in_contour;
+    const Grid *grid;
+    const int *band_rows;
+    Contours **bands;
+    int first_band;
+    int end_band;
+    int step;
+} typedef ContourTask;
+
+static void * contour_worker(void *arg) {
+    ContourTask *task = arg;
+    for (int b = task->first_band; b < task->end_band; b += task->step) {
+        task->bands[b] = new_contours();
+        if (task->bands[b] == NULL) continue;
+        //A band left without its contours makes the whole tracing fail
+        if (!trace_rows(task->bands[b], task->data, task->field, task->filter, task->gradients,
+                        task->pixel_in_contour, task->grid, task->band_rows[b], task->band_rows[b + 1])) {
+            del_contours(task->bands[b]);
+            task->bands[b] = NULL;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Function:  contour_bands
+ * --------------------
+ * Splits the rows into bands of at least CONTOUR_BAND_ROWS rows and 128 bins, so that bands two apart never share a
+ * word of a bitmap. The last band takes the rows left over.
+ *
+ * args:
+ *      Grid *grid: descriptor of the binning scheme
+ *      int *band_rows: pointer to an array of at least grid->nrows / CONTOUR_BAND_ROWS + 2 elements for the first row
+ *      of each band, followed by the number of rows
+ *
+ * returns:
+ *      int: the number of bands
+ */
+static int contour_bands(const Grid *grid, int *band_rows) {
+    int nbands = 0;
+    int row = 0;
+    band_rows[0] = 0;
+    while (row < grid->nrows) {
+        int end = row + CONTOUR_BAND_ROWS;
+        while (end < grid->nrows && row_first_bin(grid, end) - row_first_bin(grid, row) < 128) end++;
+        if (end + CONTOUR_BAND_ROWS > grid->nrows) end = grid->nrows;
+        band_rows[++nbands] = end;
+        row = end;
+    }
+    return nbands;
+}
+
+/*
+ * A run of consecutive points of a contour traced in a band, or of the points a contour was followed through once its
+ * band was left, and the part continuing it once the bands are stitched.
+ */
+struct contour_part {
+    const Contours *band;
+    int first;
+    int start;
+    int end;
+    int length;
+    int next;
+} typedef ContourPart;
+
+/*
+ * A counted point of a contour traced in a band.
+ */
+struct contour_point {
+    int bin;
+    int contour;
+    int point;
+} typedef ContourPoint;
+
+static int compare_contour_points(const void *a, const void *b) {
+    return ((const ContourPoint *) a)->bin - ((const ContourPoint *) b)->bin;
+}
+
+/*
+ * Function:  find_contour_point
+ * --------------------
+ * Finds the point of a contour at a bin among points ordered by their bin.
+ *
+ * args:
+ *      ContourPoint *points: pointer to an array of points, in increasing order of their bin
+ *      int n: the number of points
+ *      int bin: the bin to look for
+ *
+ * returns:
+ *      ContourPoint *: the point, NULL if no contour has a point at the bin
+ */
+static const ContourPoint * find_contour_point(const ContourPoint *points, int n, int bin) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if (points[mid].bin < bin) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < n && points[lo].bin == bin ? points + lo : NULL;
+}
+
+/*
+ * Function:  append_chain
+ * --------------------
+ * Appends to a set of contours the contour made of a part and the parts continuing it, each part starting at the
+ * last point of the part before it.
+ *
+ * args:
+ *      Contours *contours: the contours to append the contour to
+ *      ContourPart *parts: pointer to an array of the parts
+ *      int k: the first part
+ *
+ * returns:
+ *      int: 1 if the contour was appended, 0 if there was no memory for it
+ */
+static int append_chain(Contours *contours, const ContourPart *parts, int k) {
+    int length = 0;
+    if (!start_contour(contours, parts[k].band->bins[parts[k].start])) return 0;
+    for (int m = k; m >= 0; m = parts[m].next) {
+        const Contours *band = parts[m].band;
+        //The first point of every part but the first is already there
+        for (int p = parts[m].start + 1; p < parts[m].end; p++) {
+            if (!add_contour_point(contours, band->bins[p], band->angles[p])) return 0;
+        }
+        length += parts[m].length;
+    }
+    contours->lengths[contours->ncontours - 1] = length;
+    return 1;
+}
+
+/*
+ * Function:  take_over
+ * --------------------
+ * Links the rest of the contour a point belongs to after a part, if the contour is numbered after the given one and
+ * neither its rest nor the whole of it has been taken over yet. The contour then ends at the point without counting it,
+ * as it would have found the point taken.
+ *
+ * args:
+ *      ContourPart *parts: pointer to an array of the parts, with room for one more
+ *      int *tails: pointer to an array of the last part of each contour
+ *      char *linked: pointer to an array of flags for the parts continuing another part
+ *      int *nparts: pointer to the number of parts
+ *      int tail: the part to link the rest of the contour after
+ *      ContourPoint *point: the point, NULL if the part ends at no counted point
+ *      int k: the contour the part belongs to
+ *
+ * returns:
+ *      int: 1 if the rest of the contour was taken over, 0 if it was not
+ */
+static int take_over(ContourPart *parts, int *tails, char *linked, int *nparts, int tail, const ContourPoint *point,
+                     int k) {
+    if (point == NULL || point->contour <= k) return 0;
+    int c = point->contour;
+    if (tails[c] != c || linked[c]) return 0;
+    if (point->point == parts[c].start) {
+        parts[tail].next = c;
+        linked[c] = 1;
+    } else {
+        ContourPart rest = parts[c];
+        rest.start = point->point;
+        rest.length = parts[c].length - (point->point - parts[c].start);
+        parts[c].end = point->point + 1;
+        parts[c].length = point->point - parts[c].start;
+        parts[*nparts] = rest;
+        parts[tail].next = *nparts;
+        linked[*nparts] = 1;
+        tails[c] = (*nparts)++;
+    }
+    return 1;
+}
+
+/*
+ * Function:  continue_part
+ * --------------------
+ * Follows a contour across the whole map from the last point of a part, which has just been counted, and adds the
+ * points it was followed through as a new part. The last points of the part are copied along, so that the turns
+ * are checked as if the contour had never been cut.
+ *
+ * args:
+ *      Contours *scratch: the contours to follow the contour in
+ *      ContourPart *part: the part to continue
+ *      ContourPart *next: pointer to the part to fill in
+ *      uint64_t *data: pointer to a bitmap representing the pixels status as an edge pixel
+ *      Plane *field: the data values gradients are computed from
+ *      int filter: nonzero if field holds the original data, zero if it holds filtered data
+ *      GradientField *gradients: the precomputed gradients of the filtered data, NULL to compute them from field
+ *      uint64_t *pixel_in_contour: pointer to a bitmap of the pixels already in a contour or without data
+ *      int row: the row to follow the contour from
+ *      Grid *grid: descriptor of the binning scheme
+ *
+ * returns:
+ *      int: 1 if the contour was followed, 0 if there was no memory for it
+ */
+static int continue_part(Contours *scratch, const ContourPart *part, ContourPart *next, const uint64_t *data,
+                         const Plane *field, int filter, const GradientField *gradients, uint64_t *pixel_in_contour,
+                         int row, const Grid *grid) {
+    const Contours *band = part->band;
+    int p = part->end - 7 > part->start ? part->end - 7 : part->start;
+    if (!start_contour(scratch, band->bins[p])) return 0;
+    for (p++; p < part->end; p++) {
+        if (!add_contour_point(scratch, band->bins[p], band->angles[p])) return 0;
+    }
+    int start = scratch->npoints - 1;
+    int count = follow_contour_range(scratch, data, field, filter, gradients, pixel_in_contour, row, grid, 0,
+                                     grid->nbins);
+    if (count < 0) return 0;
+    ContourPart continued = {scratch, start, start, scratch->npoints, count - 1, -1};
+    *next = continued;
+    return 1;
+}
+
+/*
+ * Function:  stitch_bands
+ * --------------------
+ * Joins the contours traced separately in each band into a single set, as if each contour left open at a point of
+ * another band had been followed across. Contours are numbered in the order of their first bin, which is the order
+ * the whole map would have been traced in, and their open ends are handled in that order. A contour reaching a point
+ * of a contour numbered after it takes over the rest of that contour, which then ends at the point without counting
+ * it, as the later contour would have found the point taken. A contour reaching a point of a contour numbered before
+ * it, or of a contour already taken over, ends there without counting it. A contour reaching a point in no contour is
+ * followed on from it across the whole map, and can take over another contour where it ends. The joined contours are
+ * written in the order of the first bin of their first part, and neither depend on how the bands were traced.
+ *
+ * args:
+ *      Contours **bands: pointer to an array of the contours traced in each band
+ *      int nbands: the number of bands
+ *      int *band_rows: pointer to an array of the first row of each band, followed by the number of rows
+ *      uint64_t *data: pointer to a bitmap representing the pixels status as an edge pixel
+ *      Plane *field: the data values gradients are computed from
+ *      int filter: nonzero if field holds the original data, zero if it holds filtered data
+ *      GradientField *gradients: the precomputed gradients of the filtered data, NULL to compute them from field
+ *      uint64_t *pixel_in_contour: pointer to the bitmap of the pixels in a contour or without data
+ *      Grid *grid: descriptor of the binning scheme
+ *
+ * returns:
+ *      Contours *: the joined contours, NULL if there was not enough memory for them
+ */
+static Contours * stitch_bands(Contours **bands, int nbands, const int *band_rows, const uint64_t *data,
+                               const Plane *field, int filter, const GradientField *gradients,
+                               uint64_t *pixel_in_contour, const Grid *grid) {
+    int n = 0, npoints = 0;
+    for (int b = 0; b < nbands; b++) {
+        n += bands[b]->ncontours;
+        npoints += bands[b]->npoints;
+    }
+    Contours *contours = new_contours();
+    Contours *scratch = new_contours();
+    //Each contour is taken over at most once, which splits it into two parts, and continued at most once
+    ContourPart *parts = malloc((3 * n + 1) * sizeof(ContourPart));
+    int *tails = malloc((n + 1) * sizeof(int));
+    char *linked = calloc(3 * n + 1, 1);
+    ContourPoint *points = malloc((npoints + 1) * sizeof(ContourPoint));
+    int ok = contours != NULL && scratch != NULL && parts != NULL && tails != NULL && linked != NULL && points != NULL;
+    if (ok) {
+        int npoints_counted = 0;
+        for (int b = 0, k = 0; b < nbands; b++) {
+            for (int i = 0; i < bands[b]->ncontours; i++, k++) {
+                ContourPart part = {bands[b], bands[b]->offsets[i], bands[b]->offsets[i], bands[b]->offsets[i + 1],
+                                    bands[b]->lengths[i], -1};
+                parts[k] = part;
+                tails[k] = k;
+                //A last point not counted belongs to another contour
+                int end = part.length < part.end - part.start ? part.end - 1 : part.end;
+                for (int p = part.start; p < end; p++) {
+                    ContourPoint point = {bands[b]->bins[p], k, p};
+                    points[npoints_counted++] = point;
+                }
             }
         }
-        head = del_contour(head);
+        qsort(points, npoints_counted, sizeof(ContourPoint), compare_contour_points);
+
+        int nparts = n;
+        for (int b = 0, k = 0; b < nbands && ok; b++) {
+            int first_bin = row_first_bin(grid, band_rows[b]);
+            int end_bin = row_first_bin(grid, band_rows[b + 1]);
+            for (int i = 0; i < bands[b]->ncontours && ok; i++, k++) {
+                int last = bands[b]->bins[bands[b]->offsets[i + 1] - 1];
+                if (last >= first_bin && last < end_bin) continue;
+                int t = tails[k];
+                const ContourPoint *point = find_contour_point(points, npoints_counted, last);
+                if (take_over(parts, tails, linked, &nparts, t, point, k)) continue;
+                if (point != NULL || bitmap_get(pixel_in_contour, last)) continue;
+
+                //The point would have been counted and the contour followed on from it
+                bitmap_set(pixel_in_contour, last);
+                parts[t].length++;
+                const Contours *band = parts[t].band;
+                int row = grid_row(grid, band->bins[parts[t].first]);
+                for (int p = parts[t].first + 1; p < parts[t].end; p++) row = next_contour_row(row, band->angles[p]);
+                if (!can_follow(grid, last, row)) continue;
+                ok = continue_part(scratch, parts + t, parts + nparts, data, field, filter, gradients,
+                                   pixel_in_contour, row, grid);
+                if (!ok) break;
+                ContourPart *continued = parts + nparts;
+                parts[t].next = nparts;
+                linked[nparts] = 1;
+                tails[k] = nparts++;
+                if (continued->length < continued->end - continued->start - 1) {
+                    point = find_contour_point(points, npoints_counted, scratch->bins[continued->end - 1]);
+                    take_over(parts, tails, linked, &nparts, tails[k], point, k);
+                }
+            }
+        }
+        for (int k = 0; k < n && ok; k++) {
+            if (!linked[k]) ok = append_chain(contours, parts, k);
+        }
+    }
+    if (!ok) {
+        del_contours(contours);
+        contours = NULL;
+    }
+    del_contours(scratch);
+    free(parts);
+    free(tails);
+    free(linked);
+    free(points);
+    return contours;
+}
+
+/*
+ * Function:  trace_bands
+ * --------------------
+ * Traces the contours of every other band, starting from the given one, splitting the bands between threads.
+ *
+ * args:
+ *      ContourTask *task: the task with everything but the bands to trace filled in
+ *      int nbands: the number of bands
+ *      int first_band: the first band to trace
+ *      int nthreads: the number of threads to trace with
+ */
+static void trace_bands(const ContourTask *task, int nbands, int first_band, int nthreads) {
+    int n = (nbands - first_band + 1) / 2;
+    if (nthreads > n) nthreads = n;
+    if (nthreads < 1) nthreads = 1;
+    pthread_t threads[nthreads];
+    ContourTask tasks[nthreads];
+    int started[nthreads];
+    for (int t = 0; t < nthreads; t++) {
+        tasks[t] = *task;
+        tasks[t].first_band = first_band + 2 * t;
+        tasks[t].end_band = nbands;
+        tasks[t].step = 2 * nthreads;
+    }
+    for (int t = 1; t < nthreads; t++) {
+        started[t] = pthread_create(&threads[t], NULL, contour_worker, &tasks[t]) == 0;
+        if (!started[t]) contour_worker(&tasks[t]);
+    }
+    contour_worker(&tasks[0]);
+    for (int t = 1; t < nthreads; t++) {
+        if (started[t]) pthread_join(threads[t], NULL);
     }
-}
\ No newline at end of file
+}
+
+/*
+ * Function:  trace_contours_tiled
+ * --------------------
+ * Same as trace_contours, but traces the contours of bands of rows separately and in parallel, then stitches the
+ * contours crossing from one band into the next. Even bands are traced first and odd bands once they are done, so
+ * that no two bands traced at the same time share a word of the bitmap of the pixels in a contour, and the pixels the
+ * contours of each band see as taken do not depend on the number of threads. Neither do the contours, which can
+ * differ from those of trace_contours where fronts cross from one band into another.
+ *
+ * args:
+ *      uint64_t *data: pointer to a bitmap representing the pixels status as an edge pixel
+ *      Plane *field: the data values gradients are computed from
+ *      int filter: nonzero if field holds the original data, zero if it holds the data that resulted from applying a
+ *      median filter to the original data
+ *      GradientField *gradients: the precomputed gradients of the filtered data, NULL to compute them from field
+ *      Grid *grid: descriptor of the binning scheme
+ *      int nthreads: the number of threads to trace with. Values less than 2 trace in the calling thread.
+ *
+ * returns:
+ *      Contours *: the contours, to be freed with del_contours. NULL if there was not enough memory for them.
+ */
+Contours * trace_contours_tiled(const uint64_t *data, const Plane *field, int filter,
+                                const GradientField *gradients, const Grid *grid, int nthreads) {
+    uint64_t *pixel_in_contour = new_pixel_in_contour(field, filter, grid);
+    int *band_rows = malloc((grid->nrows / CONTOUR_BAND_ROWS + 2) * sizeof(int));
+    Contours **bands = NULL;
+    Contours *contours = NULL;
+    int nbands = 0;
+    if (pixel_in_contour != NULL && band_rows != NULL) {
+        nbands = contour_bands(grid, band_rows);
+        bands = calloc(nbands, sizeof(Contours *));
+    }
+    if (bands != NULL) {
+        ContourTask task = {data, field, filter, gradients, pixel_in_contour, grid, band_rows, bands, 0, 0, 0};
+        trace_bands(&task, nbands, 0, nthreads);
+        trace_bands(&task, nbands, 1, nthreads);
+        int ok = 1;
+        for (int b = 0; b < nbands; b++) {
+            if (bands[b] == NULL) ok = 0;
+        }
+        if (ok) contours = stitch_bands(bands, nbands, band_rows, data, field, filter, gradients, pixel_in_contour,
+                                      grid);
+        for (int b = 0; b < nbands; b++) del_contours(bands[b]);
+    }
+    free(bands);
+    free(band_rows);
+    free(pixel_in_contour);
+    return contours;
+}
+
+/*
+ * Function:  paint_contours
+ * --------------------
+ * Marks the bins of the points of every contour at least as long as the given length as fronts.
+ *
+ * args:
+ *      Contours *contours: the contours
+ *      int min_length: the length from which contours are fronts
+ *      int *out_data: pointer an array to write the front values for each pixel to. Set to 1 for a front and left
+ *      untouched otherwise.
+ */
+void paint_contours(const Contours *contours, int min_length, int *out_data) {
+    for (int i = 0; i < contours->ncontours; i++) {
+        if (contours->lengths[i] < min_length) continue;
+        for (int k = contours->offsets[i]; k < contours->offsets[i + 1]; k++) {
+            out_data[contours->bins[k]] = 1;
+        }
+    }
+}
+
+/*
+ * Function:  contour
+ * --------------------
+ * Traces the contours of the edge pixels and marks those at least 15 bins long as fronts.
+ *
+ * args:
+ *      uint64_t *data: pointer to a bitmap representing the pixels status as an edge pixel
+ *      Plane *field: the data values gradients are computed from
+ *      int filter: nonzero if field holds the original data, zero if it holds the data that resulted from applying a
+ *      median filter to the original data
+ *      GradientField *gradients: the precomputed gradients of the filtered data, NULL to compute them from field
+ *      int *out_data: pointer an array to write the front values for each pixel. 1 for a front, 0 for not
+ *      Grid *grid: descriptor of the binning scheme
+ *
+ */
+void contour(const uint64_t *data, const Plane *field, int filter, const GradientField *gradients, int *out_data,
+             const Grid *grid) {
+    Contours *contours = trace_contours(data, field, filter, gradients, grid);
+    if (contours == NULL) return;
+    paint_contours(contours, 15, out_data);
+    del_contours(contours);
+}
+
+/*
+ * Function:  contour_tiled
+ * --------------------
+ * Same as contour, with the contours traced by trace_contours_tiled.
+ *
+ * args:
+ *      uint64_t *data: pointer to a bitmap representing the pixels status as an edge pixel
+ *      Plane *field: the data values gradients are computed from
+ *      int filter: nonzero if field holds the original data, zero if it holds the data that resulted from applying a
+ *      median filter to the original data
+ *      GradientField *gradients: the precomputed gradients of the filtered data, NULL to compute them from field
+ *      int *out_data: pointer an array to write the front values for each pixel. 1 for a front, 0 for not
+ *      Grid *grid: descriptor of the binning scheme
+ *      int nthreads: the number of threads to trace with
+ */
+void contour_tiled(const uint64_t *data, const Plane *field, int filter, const GradientField *gradients,
+                   int *out_data, const Grid *grid, int nthreads) {
+    Contours *contours = trace_contours_tiled(data, field, filter, gradients, grid, nthreads);
+    if (contours == NULL) return;
+    paint_contours(contours, 15, out_data);
+    del_contours(contours);
+}
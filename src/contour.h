@@ -1,23 +1,55 @@
 #ifndef SIED_CONTOUR_H
 #define SIED_CONTOUR_H
-typedef struct contour_point {
-    int bin;
-    int angle;
-    struct contour_point *prev;
-    struct contour_point *next;
-} ContourPoint;
+#include "helpers.h"
 
-struct contour {
-    struct contour_point *first_point;
-    struct contour *prev;
-    struct contour *next;
-    int length;
-} typedef Contour;
+/*
+ * Contours stored one after the other in compressed sparse row layout. The points of contour i are at positions
+ * offsets[i] to offsets[i + 1] - 1 of bins and angles, so offsets holds ncontours + 1 entries. angles holds the angle
+ * between the previous point of the contour and each point, and is 0 for the first point of each contour. lengths
+ * holds the length of each contour as counted while it was followed, which leaves out a last point that was already
+ * in another contour. The arrays are grown as needed up to max_contours contours and max_points points. One set holds
+ * every contour of a run, so its few growing arrays serve as the per-run allocation of points and contours.
+ */
+struct contours {
+    int ncontours;
+    int npoints;
+    int max_contours;
+    int max_points;
+    int *offsets;
+    int *lengths;
+    int *bins;
+    int *angles;
+} typedef Contours;
 
-Contour * del_contour(Contour *n);
+/*
+ * Gradient of every bin of the filtered data, computed once as gradient computes it from the 3x3 window around the bin.
+ * The central differences are kept doubled so that they are integers.
+ */
+struct gradient_field {
+    int nbins;
+    int16_t *x;
+    int16_t *y;
+} typedef GradientField;
+
+Contours * new_contours(void);
+void del_contours(Contours *contours);
+int start_contour(Contours *contours, int bin);
+int add_contour_point(Contours *contours, int bin, int angle);
+int turn_too_sharp(const Contours *contours, int next_theta);
 double gradient_ratio(const int *window);
-ContourPoint * new_contour_point(ContourPoint *prev, int bin, int angle);
-ContourPoint * find_best_front(ContourPoint *prev, const int *data,  int row, const int *basebins, const int *nbins_in_row);
-int follow_contour(ContourPoint *prev, const int *data, const int *filtered_data, int *pixel_in_contour, int row, int nrows, const int *basebins, const int *nbins_in_row);
-void contour(int *data, int *filtered_data, int *out_data, int nbins, int nrows, const int *nbins_in_row, const int *basebins);
+GradientField * new_gradient_field(int nbins);
+void del_gradient_field(GradientField *gradients);
+void gradient_rows(GradientField *gradients, const Plane *filtered, const Grid *grid, int first_row, int end_row);
+int find_best_front(Contours *contours, const uint64_t *data,  int row, const Grid *grid);
+int follow_contour(Contours *contours, const uint64_t *data, const Plane *field, int filter,
+                   uint64_t *pixel_in_contour, int row, const Grid *grid);
+Contours * trace_contours(const uint64_t *data, const Plane *field, int filter, const GradientField *gradients,
+                          const Grid *grid);
+Contours * trace_contours_tiled(const uint64_t *data, const Plane *field, int filter,
+                                const GradientField *gradients, const Grid *grid, int nthreads);
+void paint_contours(const Contours *contours, int min_length, int *out_data);
+void contour(const uint64_t *data, const Plane *field, int filter, const GradientField *gradients, int *out_data,
+             const Grid *grid);
+void contour_tiled(const uint64_t *data, const Plane *field, int filter, const GradientField *gradients,
+                   int *out_data, const Grid *grid, int nthreads);
 #endif //SIED_CONTOUR_H
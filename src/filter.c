@@ -1,7 +1,10 @@
 /*
-* Functions for applying the median filter to an array of bins using sliding 3x3 window
+* Functions for applying the median filter to a plane of bins using sliding 3x3 window
 */
 #include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <string.h>
 #include "filter.h"
 #include "helpers.h"
 #include "cayula.h"
@@ -80,40 +83,612 @@ static int medianN(int * p, int n_invalid) {
 }
 
 /*
- * Function:  median_filter
+ * A column of a 3x3 window, holding the values of the bin and of its north and south neighbors in ascending order and
+ * the number of fill values among them.
+ */
+typedef struct column {
+    int v[3];
+    int nfill;
+} Column;
+
+/*
+ * Function:  sorted_column
  * --------------------
- * Applies a median filter with a fixed 3x3 kernel with the median determined using a sorting network. For the case of
- * a 3x3 kernel and 256 possible values, this method is generally faster than a histogram based approach. If the kernel
- * contains fill values, the median is determined using however many valid values there are in the kernel.
+ * Reads and sorts the column of the 3x3 window at the given distance from the center bin.
+ *
+ * args:
+ *      Plane *data: the data to be filtered
+ *      Grid *grid: descriptor of the binning scheme
+ *      int bin: the center bin of the window
+ *      int row: the row of the center bin
+ *      int dcol: the distance of the column from the center bin, -1, 0 or 1
+ *
+ * returns:
+ *      Column: the sorted column
+ */
+static inline Column sorted_column(const Plane *data, const Grid *grid, int bin, int row, int dcol) {
+    Column c;
+    c.v[0] = plane_value(data, grid->basebins[row - 1] + grid->north[bin] + dcol);
+    c.v[1] = plane_value(data, bin + dcol);
+    c.v[2] = plane_value(data, grid->basebins[row + 1] + grid->south[bin] + dcol);
+    BIN_SORT(c.v[1], c.v[2]);
+    BIN_SORT(c.v[0], c.v[1]);
+    BIN_SORT(c.v[1], c.v[2]);
+    c.nfill = (c.v[0] == FILL_VALUE) + (c.v[1] == FILL_VALUE) + (c.v[2] == FILL_VALUE);
+    return c;
+}
+
+static inline int min3(int a, int b, int c) {
+    int m = a < b ? a : b;
+    return m < c ? m : c;
+}
+
+static inline int max3(int a, int b, int c) {
+    int m = a > b ? a : b;
+    return m > c ? m : c;
+}
+
+static inline int med3(int a, int b, int c) {
+    BIN_SORT(a, b);
+    return b < c ? b : (a > c ? a : c);
+}
+
+/*
+ * Function:  median_columns
+ * --------------------
+ * Determines the median of a 3x3 window from its three sorted columns without fill values. The median of the window
+ * is the median of the largest of the column minimums, the median of the column medians and the smallest of the
+ * column maximums.
+ *
+ * args:
+ *      Column *a, *b, *c: the sorted columns of the window
+ *
+ * returns:
+ *      int: the median of the window
+ */
+static inline int median_columns(const Column *a, const Column *b, const Column *c) {
+    return med3(max3(a->v[0], b->v[0], c->v[0]), med3(a->v[1], b->v[1], c->v[1]), min3(a->v[2], b->v[2], c->v[2]));
+}
+
+/*
+ * Function:  median_columns_fill
+ * --------------------
+ * Determines the median of a 3x3 window containing fill values from its three sorted columns. The columns are merged
+ * into the sorted window, where fill values come first, and the median is selected from the valid values the same way
+ * as medianN.
+ *
+ * args:
+ *      Column *a, *b, *c: the sorted columns of the window
+ *      int n_invalid: number of fill values contained in the window
+ *
+ * returns:
+ *      int: the median of the window after excluding fill values
+ */
+static int median_columns_fill(const Column *a, const Column *b, const Column *c, int n_invalid) {
+    if (n_invalid == 9) return FILL_VALUE;
+    int sorted[9];
+    int i = 0, j = 0, k = 0;
+    for (int n = 0; n < 9; n++) {
+        int va = i < 3 ? a->v[i] : INT32_MAX;
+        int vb = j < 3 ? b->v[j] : INT32_MAX;
+        int vc = k < 3 ? c->v[k] : INT32_MAX;
+        if (va <= vb && va <= vc) {
+            sorted[n] = va;
+            i++;
+        } else if (vb <= vc) {
+            sorted[n] = vb;
+            j++;
+        } else {
+            sorted[n] = vc;
+            k++;
+        }
+    }
+    int *arr = sorted + n_invalid;
+    int n = 9 - n_invalid;
+    return n & 1 ? arr[(n - 1) >> 1] : (arr[n >> 1] + arr[(n >> 1) - 1] + 1) >> 1;
+}
+
+/*
+ * Function:  median_row_sweep
+ * --------------------
+ * Applies the median filter to a run of consecutive bins of a row by sweeping a 3x3 window along it. Adjacent windows
+ * share two of their three columns, so as long as the north and south neighbors of consecutive bins are also
+ * consecutive, each step only reads and sorts the one new column. Where the rows above or below shift relative to the
+ * row being filtered, the columns are read again.
+ *
+ * args:
+ *      Plane *data: the data to be filtered
+ *      Plane *filtered_data: the output plane
+ *      Grid *grid: descriptor of the binning scheme
+ *      int row: the row of the bins
+ *      int start: the first bin to filter
+ *      int end: the bin after the last bin to filter
+ */
+static void median_row_sweep(const Plane *data, Plane *filtered_data, const Grid *grid, int row, int start, int end) {
+    Column c0, c1, c2;
+    for (int j = start; j < end; j++) {
+        if (j > start && grid->north[j] == grid->north[j - 1] + 1 && grid->south[j] == grid->south[j - 1] + 1) {
+            c0 = c1;
+            c1 = c2;
+            c2 = sorted_column(data, grid, j, row, 1);
+        } else {
+            c0 = sorted_column(data, grid, j, row, -1);
+            c1 = sorted_column(data, grid, j, row, 0);
+            c2 = sorted_column(data, grid, j, row, 1);
+        }
+        int n_invalid = c0.nfill + c1.nfill + c2.nfill;
+        if (!plane_valid(data, j)) {
+            plane_set(filtered_data, j, FILL_VALUE);
+        } else if (n_invalid == 0) {
+            plane_set(filtered_data, j, median_columns(&c0, &c1, &c2));
+        } else {
+            plane_set(filtered_data, j, median_columns_fill(&c0, &c1, &c2, n_invalid));
+        }
+    }
+}
+
+/*
+ * Function:  median_bin
+ * --------------------
+ * Applies the median filter to a single bin.
+ *
+ * args:
+ *      Plane *data: the data to be filtered
+ *      Grid *grid: descriptor of the binning scheme
+ *      int bin: the bin to filter
+ *      int row: the row of the bin
+ *
+ * returns:
+ *      int: the median of the 3x3 window centered on the bin, or a fill value if the bin is invalid
+ */
+static inline int median_bin(const Plane *data, const Grid *grid, int bin, int row) {
+    if (!plane_valid(data, bin)) return FILL_VALUE;
+    int window[9];
+    int first_bins[3] = {grid->basebins[row - 1] + grid->north[bin] - 1, bin - 1,
+                         grid->basebins[row + 1] + grid->south[bin] - 1};
+    int n_invalid = 0;
+    for (int i = 0; i < 3; i++) {
+        int first = first_bins[i] - data->first;
+        uint32_t valid = bitmap_run(data->valid, first, 3);
+        for (int j = 0; j < 3; j++) {
+            int mask = -(int) ((valid >> j) & 1);
+            window[i * 3 + j] = (data->values[first + j] & mask) | (FILL_VALUE & ~mask);
+            n_invalid += mask + 1;
+        }
+    }
+    return n_invalid == 0 ? median9(window) : medianN(window, n_invalid);
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+
+/*
+ * Data values fit in 16 bits, so the sorting network of median9 is evaluated on packed 16 bit
+ * integers, 16 bins at a time with AVX2 and 8 bins at a time with SSE2.
+ */
+#ifdef __AVX2__
+#define LANES 16
+typedef __m256i vec;
+#define VLOAD(p) _mm256_load_si256((const __m256i *) (p))
+#define VSTORE(p, a) _mm256_store_si256((__m256i *) (p), a)
+#define VMIN(a, b) _mm256_min_epi16(a, b)
+#define VMAX(a, b) _mm256_max_epi16(a, b)
+#else
+#define LANES 8
+typedef __m128i vec;
+#define VLOAD(p) _mm_load_si128((const __m128i *) (p))
+#define VSTORE(p, a) _mm_store_si128((__m128i *) (p), a)
+#define VMIN(a, b) _mm_min_epi16(a, b)
+#define VMAX(a, b) _mm_max_epi16(a, b)
+#endif
+
+#define VSORT(a,b) { vec lo = VMIN(a, b); (b) = VMAX(a, b); (a) = lo; }
+
+/*
+ * Function:  median9_lanes
+ * --------------------
+ * Applies the median filter to LANES consecutive bins of a row. The 3x3 windows are gathered into one packed vector
+ * per window position and the median9 network is evaluated on all of them at once. Each row of a window is a run of
+ * three bits of the validity bitmap, so bins whose window contains an invalid bin are found from a few words of the
+ * bitmap without reading their values and are handed to the scalar median_bin.
  *
  * args:
- *      int *data: pointer to array containing the data to be filtered
- *      int *filtered_data: pointer to output array
- *      int nbins: the number of bins in the binning scheme
- *      int nrows: the number of rows in the binning scheme,
- *      int *nbins_in_row: pointer to an array the number of bins in each row
- *      int *basebins: pointer to an array containing the bin number of the first bin in each row
+ *      Plane *data: the data to be filtered
+ *      Plane *filtered_data: the output plane
+ *      Grid *grid: descriptor of the binning scheme
+ *      int bin: the first bin to filter
+ *      int row: the row of the bins
  */
-void median_filter(int *data, int *filtered_data, int nbins, int nrows, int *nbins_in_row, int *basebins) {
-    int last_row = nrows - 1;
+static void median9_lanes(const Plane *data, Plane *filtered_data, const Grid *grid, int bin, int row) {
+    int16_t w[9][LANES] __attribute__((aligned(32)));
+    int16_t median[LANES] __attribute__((aligned(32)));
+    //Positions of the bins relative to the first bin held by the plane
+    int north = grid->basebins[row - 1] - 1 - data->first;
+    int center = bin - 1 - data->first;
+    int south = grid->basebins[row + 1] - 1 - data->first;
+    int n0 = north + grid->north[bin];
+    int s0 = south + grid->south[bin];
+    uint64_t north_valid = bitmap_word(data->valid, n0);
+    uint64_t center_valid = bitmap_word(data->valid, center);
+    uint64_t south_valid = bitmap_word(data->valid, s0);
+    int north_span = grid->north[bin + LANES - 1] - grid->north[bin] + 3;
+    int south_span = grid->south[bin + LANES - 1] - grid->south[bin] + 3;
     /*
-     * Fill in the first and last row with fill values. Then iterate through the remaining rows while filling the
-     * first and last bin of each row with fill values and the rest with the result of the median filter.
+     * When every bin the windows reach is valid there is no need to check the windows one by one. Rows much longer
+     * than the row being filtered can spread the neighbors over more than one word, which is checked bin by bin.
      */
-    for (int i = 0; i < basebins[0] + nbins_in_row[0]; i++) filtered_data[i] = FILL_VALUE;
-    for (int i = basebins[last_row]; i < basebins[last_row] + nbins_in_row[last_row]; i++) filtered_data[i] = FILL_VALUE;
-
-    for (int i = 1; i < nrows - 1; i++) {
-        filtered_data[basebins[i]] = FILL_VALUE;
-        filtered_data[basebins[i] + nbins_in_row[i] - 1] = FILL_VALUE;
-        for (int j = basebins[i] + 1; j < basebins[i] + nbins_in_row[i] - 1; j++) {
-            if (data[j] == FILL_VALUE) {
-                filtered_data[j] = FILL_VALUE;
-            } else {
-                int window[9];
-                int n_invalid = get_window(j, i, 3, data, nbins_in_row, basebins, window);
-                filtered_data[j] = n_invalid == 0 ? median9(window) : medianN(window, n_invalid);
+    int all_valid = north_span < 64 && south_span < 64 &&
+                    (~north_valid & (((uint64_t) 1 << north_span) - 1)) == 0 &&
+                    (~south_valid & (((uint64_t) 1 << south_span) - 1)) == 0 &&
+                    (~center_valid & (((uint64_t) 1 << (LANES + 2)) - 1)) == 0;
+    const uint16_t *v = data->values;
+    unsigned int fill = 0;
+    for (int k = 0; k < LANES; k++) {
+        int n = north + grid->north[bin + k];
+        int c = center + k;
+        int s = south + grid->south[bin + k];
+        if (!all_valid) {
+            uint64_t valid = (n - n0 < 62 ? north_valid >> (n - n0) : bitmap_word(data->valid, n)) &
+                             (s - s0 < 62 ? south_valid >> (s - s0) : bitmap_word(data->valid, s)) &
+                             center_valid >> k;
+            if ((valid & 7) != 7) fill |= 1u << k;
+        }
+        w[0][k] = v[n]; w[1][k] = v[n + 1]; w[2][k] = v[n + 2];
+        w[3][k] = v[c]; w[4][k] = v[c + 1]; w[5][k] = v[c + 2];
+        w[6][k] = v[s]; w[7][k] = v[s + 1]; w[8][k] = v[s + 2];
+    }
+    vec p0 = VLOAD(w[0]), p1 = VLOAD(w[1]), p2 = VLOAD(w[2]), p3 = VLOAD(w[3]), p4 = VLOAD(w[4]);
+    vec p5 = VLOAD(w[5]), p6 = VLOAD(w[6]), p7 = VLOAD(w[7]), p8 = VLOAD(w[8]);
+
+    VSORT(p1, p2);  VSORT(p4, p5);  VSORT(p7, p8);
+    VSORT(p0, p1);  VSORT(p3, p4);  VSORT(p6, p7);
+    VSORT(p1, p2);  VSORT(p4, p5);  VSORT(p7, p8);
+    VSORT(p0, p3);  VSORT(p5, p8);  VSORT(p4, p7);
+    VSORT(p3, p6);  VSORT(p1, p4);  VSORT(p2, p5);
+    VSORT(p4, p7);  VSORT(p4, p2);  VSORT(p6, p4);
+    VSORT(p4, p2);
+    VSTORE(median, p4);
+
+    /*
+     * The median of a window around a valid bin is always valid, so the filtered bins are valid exactly where the
+     * input bins are.
+     */
+    uint16_t *out = filtered_data->values + bin - filtered_data->first;
+    for (int k = 0; k < LANES; k++) {
+        if (fill & (1u << k)) {
+            int value = median_bin(data, grid, bin + k, row);
+            out[k] = value == FILL_VALUE ? 0 : value;
+        } else {
+            out[k] = median[k];
+        }
+    }
+    bitmap_write(filtered_data->valid, bin - filtered_data->first, LANES, (uint32_t) (center_valid >> 1));
+}
+#endif
+
+/*
+ * Function:  median_row_network
+ * --------------------
+ * Applies the median filter to the bins of a row falling in the given range, filling the first and last bin of the
+ * row with fill values.
+ *
+ * args:
+ *      Plane *data: the data to be filtered
+ *      Plane *filtered_data: the output plane
+ *      Grid *grid: descriptor of the binning scheme
+ *      int row: the row to filter
+ *      int lo: the first bin of the range
+ *      int hi: the bin after the last bin of the range
+ */
+static void median_row_network(const Plane *data, Plane *filtered_data, const Grid *grid, int row, int lo, int hi) {
+    int first = grid->basebins[row];
+    int last = first + grid->nbins_in_row[row] - 1;
+    if (first >= lo && first < hi) plane_set(filtered_data, first, FILL_VALUE);
+    if (last >= lo && last < hi) plane_set(filtered_data, last, FILL_VALUE);
+    int j = lo > first + 1 ? lo : first + 1;
+    int end = hi < last ? hi : last;
+#ifdef LANES
+    for (; j + LANES <= end; j += LANES) {
+        median9_lanes(data, filtered_data, grid, j, row);
+    }
+#endif
+    median_row_sweep(data, filtered_data, grid, row, j, end);
+}
+
+/*
+ * Function:  histogram_select
+ * --------------------
+ * Finds the k-th smallest value counted in a two level histogram of values ranging from 0 to MAX_LEVELS - 1. The
+ * coarse level counts the values falling in each group of 16 fine bins, so the search steps over at most 16 fine bins
+ * and as many coarse bins as the value sought has groups of 16 below it, 16 for 8 bit data.
+ *
+ * args:
+ *      int *coarse: pointer to the MAX_LEVELS / 16 element coarse histogram
+ *      int *fine: pointer to the MAX_LEVELS element fine histogram
+ *      int k: the rank of the desired value, starting at 0
+ *
+ * returns:
+ *      int: the k-th smallest value
+ */
+static inline int histogram_select(const int *coarse, const int *fine, int k) {
+    int c = 0;
+    while (k >= coarse[c]) k -= coarse[c++];
+    int v = c << 4;
+    while (k >= fine[v]) k -= fine[v++];
+    return v;
+}
+
+#define HISTOGRAM_ADD(m) \
+    { if (plane_valid(data, m)) { int v = data->values[(m) - data->first]; fine[v]++; coarse[v >> 4]++; n++; } }
+#define HISTOGRAM_REMOVE(m) \
+    { if (plane_valid(data, m)) { int v = data->values[(m) - data->first]; fine[v]--; coarse[v >> 4]--; n--; } }
+
+/*
+ * Function:  median_row_histogram
+ * --------------------
+ * Applies a median filter with a square kernel of any odd width to the bins of a row falling in the given range by
+ * sliding a histogram of the window along the row. Each row of the window is a run of consecutive bins, so moving to
+ * the next bin only removes the values that leave the start of each run and adds those entering at its end, which keeps
+ * the cost per bin proportional to the width rather than to the area of the kernel. The median is then found in a two
+ * level histogram. Fill values are excluded the same way as in medianN. Bins closer to the ends of the row than half
+ * the width are filled with fill values, as are bins whose window would reach outside the map and all bins of rows
+ * whose window would reach a row shorter than the kernel.
+ *
+ * args:
+ *      Plane *data: the data to be filtered
+ *      Plane *filtered_data: the output plane
+ *      Grid *grid: descriptor of the binning scheme
+ *      int row: the row to filter
+ *      int width: the width of the kernel
+ *      int lo: the first bin of the range
+ *      int hi: the bin after the last bin of the range
+ */
+static void median_row_histogram(const Plane *data, Plane *filtered_data, const Grid *grid, int row, int width,
+                                 int lo, int hi) {
+    int r = width >> 1;
+    int first = grid->basebins[row];
+    int end = first + grid->nbins_in_row[row];
+    int short_row = 0;
+    for (int k = row - r; k <= row + r; k++) {
+        if (grid->nbins_in_row[k] < width) short_row = 1;
+    }
+    if (short_row) {
+        for (int j = lo; j < hi; j++) plane_set(filtered_data, j, FILL_VALUE);
+        return;
+    }
+    for (int j = lo; j < first + r && j < hi; j++) plane_set(filtered_data, j, FILL_VALUE);
+    for (int j = end - r > lo ? end - r : lo; j < hi; j++) plane_set(filtered_data, j, FILL_VALUE);
+    int start = lo > first + r ? lo : first + r;
+    int stop = hi < end - r ? hi : end - r;
+
+    int fine[MAX_LEVELS] = {0};
+    int coarse[MAX_LEVELS >> 4] = {0};
+    int n = 0;
+    int runs[width];
+    int next_runs[width];
+    int started = 0;
+    for (int j = start; j < stop; j++) {
+        grid_window_rows(grid, j, row, width, next_runs);
+        if (next_runs[0] < 0 || next_runs[width - 1] + width > grid->nbins) {
+            plane_set(filtered_data, j, FILL_VALUE);
+            continue;
+        }
+        for (int k = 0; k < width; k++) {
+            int b = next_runs[k];
+            if (!started) {
+                for (int m = b; m < b + width; m++) HISTOGRAM_ADD(m);
+            } else if (b != runs[k]) {
+                int a = runs[k];
+                int leave_end = a + width < b ? a + width : b;
+                int enter_start = a + width > b ? a + width : b;
+                for (int m = a; m < leave_end; m++) HISTOGRAM_REMOVE(m);
+                for (int m = enter_start; m < b + width; m++) HISTOGRAM_ADD(m);
             }
+            runs[k] = b;
+        }
+        started = 1;
+
+        if (!plane_valid(data, j) || n == 0) {
+            plane_set(filtered_data, j, FILL_VALUE);
+        } else if (n & 1) {
+            plane_set(filtered_data, j, histogram_select(coarse, fine, (n - 1) >> 1));
+        } else {
+            int low = histogram_select(coarse, fine, (n >> 1) - 1);
+            int high = histogram_select(coarse, fine, n >> 1);
+            plane_set(filtered_data, j, (low + high + 1) >> 1);
+        }
+    }
+}
+
+struct filter_task {
+    const Plane *data;
+    Plane *filtered_data;
+    const Grid *grid;
+    int width;
+    int first_row;
+    int first_bin;
+    int end_bin;
+} typedef FilterTask;
+
+static void * filter_worker(void *arg) {
+    FilterTask *task = arg;
+    const Grid *grid = task->grid;
+    int r = task->width >> 1;
+    for (int i = task->first_row; i < grid->nrows && grid->basebins[i] < task->end_bin; i++) {
+        int first = grid->basebins[i];
+        int end = first + grid->nbins_in_row[i];
+        int lo = first > task->first_bin ? first : task->first_bin;
+        int hi = end < task->end_bin ? end : task->end_bin;
+        if (i < r || i >= grid->nrows - r) {
+            for (int j = lo; j < hi; j++) plane_set(task->filtered_data, j, FILL_VALUE);
+        } else if (task->width == 3) {
+            median_row_network(task->data, task->filtered_data, grid, i, lo, hi);
+        } else {
+            median_row_histogram(task->data, task->filtered_data, grid, i, task->width, lo, hi);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Function:  filter_bins
+ * --------------------
+ * Applies a median filter to a range of bins, splitting the range between threads on words of the validity bitmap.
+ *
+ * args:
+ *      Plane *data: the data to be filtered
+ *      Plane *filtered_data: the output plane, which must hold the range
+ *      Grid *grid: descriptor of the binning scheme
+ *      int width: the width of the kernel
+ *      int first_bin: the first bin of the range
+ *      int end_bin: the bin after the last bin of the range
+ *      int nthreads: the number of threads to filter with
+ */
+static void filter_bins(const Plane *data, Plane *filtered_data, const Grid *grid, int width, int first_bin,
+                        int end_bin, int nthreads) {
+    int row = grid_row(grid, first_bin);
+    FilterTask task = {data, filtered_data, grid, width, row, first_bin, end_bin};
+    int nbins = end_bin - first_bin;
+    if (nthreads > nbins / 64) nthreads = nbins / 64;
+    if (nthreads < 2) {
+        filter_worker(&task);
+        return;
+    }
+
+    pthread_t threads[nthreads];
+    FilterTask tasks[nthreads];
+    int started[nthreads];
+    for (int t = 0; t < nthreads; t++) {
+        tasks[t] = task;
+        tasks[t].first_bin = t == 0 ? first_bin : (int) (first_bin + (long) nbins * t / nthreads) & ~63;
+        tasks[t].end_bin = t == nthreads - 1 ? end_bin : (int) (first_bin + (long) nbins * (t + 1) / nthreads) & ~63;
+        while (row + 1 < grid->nrows && grid->basebins[row + 1] <= tasks[t].first_bin) row++;
+        tasks[t].first_row = row;
+    }
+    for (int t = 0; t < nthreads; t++) {
+        started[t] = pthread_create(&threads[t], NULL, filter_worker, &tasks[t]) == 0;
+        if (!started[t]) filter_worker(&tasks[t]);
+    }
+    for (int t = 0; t < nthreads; t++) {
+        if (started[t]) pthread_join(threads[t], NULL);
+    }
+}
+
+/*
+ * Function:  median_filter_kernel
+ * --------------------
+ * Applies a median filter with a square kernel of the given odd width. A width of 3 uses the sorting network of
+ * median_filter, while wider kernels, for which sorting networks do not scale, slide a histogram of the kernel along
+ * each row. If the kernel contains fill values, the median is determined using however many valid values there are in
+ * the kernel. Rows and bins closer to the edges of the map than half the width are filled with fill values.
+ *
+ * Each output bin only depends on the input data, so the bins can be split into bands filtered by separate threads.
+ * Bands hold about the same number of bins, as rows near the poles are much shorter, and start on a word of the
+ * validity bitmap so that no word is written by two threads. A band may therefore start or end in the middle of a row.
+ *
+ * args:
+ *      Plane *data: the data to be filtered
+ *      Plane *filtered_data: the output plane
+ *      Grid *grid: descriptor of the binning scheme
+ *      int width: the width of the kernel. Must be odd and at least 3.
+ *      int nthreads: the number of threads to filter with. Values less than 2 filter in the calling thread.
+ */
+void median_filter_kernel(const Plane *data, Plane *filtered_data, const Grid *grid, int width, int nthreads) {
+    filter_bins(data, filtered_data, grid, width, 0, grid->nbins, nthreads);
+}
+
+/*
+ * Function:  median_filter
+ * --------------------
+ * Applies a median filter with a fixed 3x3 kernel with the median determined using a sorting network. For the case of
+ * a 3x3 kernel and 256 possible values, this method is generally faster than a histogram based approach. If the kernel
+ * contains fill values, the median is determined using however many valid values there are in the kernel. When
+ * compiled for SSE2 or AVX2, the network is applied to several consecutive bins of a row at once, and the bins left
+ * over at the end of each row are filtered by sweeping the window along the row. Otherwise the whole row is swept.
+ * Bins are split between threads as in median_filter_kernel.
+ *
+ * args:
+ *      Plane *data: the data to be filtered
+ *      Plane *filtered_data: the output plane
+ *      Grid *grid: descriptor of the binning scheme
+ *      int nthreads: the number of threads to filter with. Values less than 2 filter in the calling thread.
+ */
+void median_filter(const Plane *data, Plane *filtered_data, const Grid *grid, int nthreads) {
+    median_filter_kernel(data, filtered_data, grid, 3, nthreads);
+}
+
+/*
+ * Function:  median_filter_bin
+ * --------------------
+ * Applies the 3x3 median filter to a single bin, giving the same value median_filter would give it. Used to find the
+ * filtered value of the few bins that are needed after the rows around them have been streamed.
+ *
+ * args:
+ *      Plane *data: the data to be filtered
+ *      Grid *grid: descriptor of the binning scheme
+ *      int bin: the bin to filter
+ *      int row: the row of the bin
+ *
+ * returns:
+ *      int: the filtered value of the bin, or a fill value
+ */
+int median_filter_bin(const Plane *data, const Grid *grid, int bin, int row) {
+    if (row < 1 || row >= grid->nrows - 1) return FILL_VALUE;
+    if (bin == grid->basebins[row] || bin == grid->basebins[row] + grid->nbins_in_row[row] - 1) return FILL_VALUE;
+    return median_bin(data, grid, bin, row);
+}
+
+/*
+ * Function:  median_filter_stream
+ * --------------------
+ * Applies the 3x3 median filter of median_filter row by row without keeping the whole filtered map. Rows are filtered
+ * in batches of window_rows rows, split between threads as in median_filter_kernel, into a plane holding only the
+ * current and the previous batch. The consumer is then called for each row of the batch in order. When it is called
+ * for a row, the plane holds at least the window_rows rows ending with that row, so a consumer analysing windows of
+ * that many rows can start on them as soon as their last row is filtered. Older rows are discarded as the plane slides
+ * forward, so memory is bounded by the length of 2 * window_rows rows rather than by the size of the map.
+ *
+ * args:
+ *      Plane *data: the data to be filtered
+ *      Grid *grid: descriptor of the binning scheme
+ *      int window_rows: the number of rows the consumer needs to see at once
+ *      int nthreads: the number of threads to filter with. Values less than 2 filter in the calling thread.
+ *      RowConsumer consumer: function called with the context, the plane of filtered rows and the row just filtered
+ *      void *context: pointer passed on to the consumer
+ *
+ * returns:
+ *      int: 1 if the rows were filtered, 0 if the plane could not be allocated
+ */
+int median_filter_stream(const Plane *data, const Grid *grid, int window_rows, int nthreads, RowConsumer consumer,
+                         void *context) {
+    int nrows = grid->nrows;
+    const int *basebins = grid->basebins;
+    int max_bins = 0;
+    for (int i = 0; i < nrows; i++) {
+        int end = i + 2 * window_rows < nrows ? i + 2 * window_rows : nrows;
+        int n = basebins[end - 1] + grid->nbins_in_row[end - 1] - basebins[i];
+        if (n > max_bins) max_bins = n;
+    }
+    Plane *rows = new_plane(max_bins + 64);
+    if (rows == NULL) return 0;
+
+    for (int first_row = 0; first_row < nrows; first_row += window_rows) {
+        int end_row = first_row + window_rows < nrows ? first_row + window_rows : nrows;
+        int keep_row = first_row - window_rows + 1 > 0 ? first_row - window_rows + 1 : 0;
+        int first = basebins[keep_row] & ~63;
+        int shift = first - rows->first;
+        int kept = basebins[first_row] - first;
+        if (shift > 0) {
+            memmove(rows->values, rows->values + shift, kept * sizeof(uint16_t));
+            memmove(rows->valid, rows->valid + (shift >> 6), ((kept >> 6) + 1) * sizeof(uint64_t));
+            rows->first = first;
+        }
+        int end_bin = end_row < nrows ? basebins[end_row] : grid->nbins;
+        filter_bins(data, rows, grid, 3, basebins[first_row], end_bin, nthreads);
+        for (int i = first_row; i < end_row; i++) {
+            consumer(context, rows, i);
         }
     }
-}
\ No newline at end of file
+    del_plane(rows);
+    return 1;
+}
@@ -1,7 +1,16 @@
 
 #ifndef SIED_FILTER_H
 #define SIED_FILTER_H
+#include "helpers.h"
 
-void median_filter(int *data, int *filtered_data, int nbins, int nrows,
-                   int *nbins_in_row, int *basebins);
+/*
+ * Function called by median_filter_stream for each filtered row, with the plane holding the most recent rows.
+ */
+typedef void (*RowConsumer)(void *context, const Plane *rows, int row);
+
+void median_filter(const Plane *data, Plane *filtered_data, const Grid *grid, int nthreads);
+void median_filter_kernel(const Plane *data, Plane *filtered_data, const Grid *grid, int width, int nthreads);
+int median_filter_bin(const Plane *data, const Grid *grid, int bin, int row);
+int median_filter_stream(const Plane *data, const Grid *grid, int window_rows, int nthreads, RowConsumer consumer,
+                         void *context);
 #endif //SIED_FILTER_H
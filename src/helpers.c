@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include "helpers.h"
 #include "cayula.h"
 
@@ -52,6 +53,33 @@ int get_window(int bin, int row, int width, const int *data, const int *n_bins_i
     return nfill_values;
 }
 
+/*
+ * Function:  get_window_rows
+ * --------------------
+ * Selects the bin number of the first bin of each row of the window get_window would select, using the ratio between
+ * the position of the bin in the given row and the length of that row. Unlike grid_window_rows, the given row does
+ * not need to be the row of the bin.
+ *
+ * args:
+ *      int bin: bin number of the center bin in the window. If the width of the window is even, then this is the upper
+ *      left bin in the center.
+ *      int row: the row number used to locate the center bin. Row numbers begin with 0.
+ *      int width: the width of the desired window. Width must be a positive number greater than 2.
+ *      int *n_bins_in_row: pointer to an array containing the number of bins in each row
+ *      int *basebins: pointer to an array containing the bin number for the first bin in each row
+ *      int *first_bins: pointer to output array for the first bin of each row. The array should be of width length
+ */
+void get_window_rows(int bin, int row, int width, const int *n_bins_in_row, const int *basebins, int first_bins[]) {
+    double ratio = ((double) bin - basebins[row]) /  n_bins_in_row[row];
+    int max_distance = width % 2 == 0 ? width >> 1 : (width - 1) >> 1;
+    int offset = width % 2 == 0 ? 1 - max_distance : -max_distance;
+    int current_row = width % 2 == 0 ? row - max_distance + 1 : row - max_distance;
+    for (int i = 0; i < width; i++) {
+        first_bins[i] = (int) (ratio * n_bins_in_row[current_row] + 0.5) + basebins[current_row] + offset;
+        current_row++;
+    }
+}
+
 void get_bin_window(int bin, int row, int width, const int *n_bins_in_row, const int *basebins, int window[]) {
     int nfill_values = 0;
     int column_neighbor;
@@ -79,4 +107,377 @@ void get_bin_window(int bin, int row, int width, const int *n_bins_in_row, const
             current_row++;
         }
     }
-}
\ No newline at end of file
+}
+
+/*
+ * Function:  neighbor_column
+ * --------------------
+ * Determines the column in the given row of the bin nearest in position to the given bin, using the ratio between the
+ * position of the bin in its row and the total number of bins in its row.
+ *
+ * args:
+ *      int bin: bin number of the bin of interest
+ *      int row: the row number of the bin of interest
+ *      int other_row: the row number in which to find the nearest bin
+ *      int *n_bins_in_row: pointer to an array containing the number of bins in each row
+ *      int *basebins: pointer to an array containing the bin number for the first bin in each row
+ * returns:
+ *      int the column of the nearest bin in other_row
+ */
+static inline int neighbor_column(int bin, int row, int other_row, const int *n_bins_in_row, const int *basebins) {
+    double ratio = ((double) bin - basebins[row]) /  n_bins_in_row[row];
+    return (int) (ratio * n_bins_in_row[other_row] + 0.5);
+}
+
+/*
+ * Function:  new_grid
+ * --------------------
+ * Creates the descriptor of a binning scheme and precomputes the north and south neighbor column of every bin. The
+ * descriptor keeps pointers to the provided arrays rather than copies, so they must outlive it.
+ *
+ * args:
+ *      int nbins: the number of bins in the binning scheme
+ *      int nrows: the number of rows in the binning scheme
+ *      int *nbins_in_row: pointer to an array containing the number of bins in each row
+ *      int *basebins: pointer to an array containing the bin number for the first bin in each row
+ * returns:
+ *      Grid *: the new descriptor, or NULL if it could not be allocated or a row is too long for 16 bit columns
+ */
+Grid * new_grid(int nbins, int nrows, const int *nbins_in_row, const int *basebins) {
+    for (int i = 0; i < nrows; i++) {
+        if (nbins_in_row[i] > INT16_MAX + 1) return NULL;
+    }
+    Grid *grid = malloc(sizeof(Grid));
+    if (grid == NULL) return NULL;
+    grid->nbins = nbins;
+    grid->nrows = nrows;
+    grid->nbins_in_row = nbins_in_row;
+    grid->basebins = basebins;
+    grid->north = malloc(nbins * sizeof(int16_t));
+    grid->south = malloc(nbins * sizeof(int16_t));
+    if (grid->north == NULL || grid->south == NULL) {
+        del_grid(grid);
+        return NULL;
+    }
+
+    for (int i = 0; i < nrows; i++) {
+        for (int j = basebins[i]; j < basebins[i] + nbins_in_row[i]; j++) {
+            grid->north[j] = i > 0 ? neighbor_column(j, i, i - 1, nbins_in_row, basebins) : -1;
+            grid->south[j] = i < nrows - 1 ? neighbor_column(j, i, i + 1, nbins_in_row, basebins) : -1;
+        }
+    }
+    return grid;
+}
+
+/*
+ * Function:  del_grid
+ * --------------------
+ * Frees the descriptor and its neighbor tables. The arrays describing the rows are not freed.
+ *
+ * args:
+ *      Grid *grid: the descriptor to free
+ */
+void del_grid(Grid *grid) {
+    if (grid == NULL) return;
+    free(grid->north);
+    free(grid->south);
+    free(grid);
+}
+
+/*
+ * Function:  new_bitmap
+ * --------------------
+ * Allocates a bitmap with all bits cleared.
+ *
+ * args:
+ *      int nbits: the number of bits in the bitmap
+ * returns:
+ *      uint64_t *: the new bitmap, or NULL if it could not be allocated
+ */
+uint64_t * new_bitmap(int nbits) {
+    return calloc(BITMAP_WORDS(nbits), sizeof(uint64_t));
+}
+
+/*
+ * Function:  new_plane
+ * --------------------
+ * Allocates a plane of data values with every bin marked as invalid.
+ *
+ * args:
+ *      int nbins: the number of bins in the binning scheme
+ * returns:
+ *      Plane *: the new plane, or NULL if it could not be allocated
+ */
+Plane * new_plane(int nbins) {
+    Plane *plane = malloc(sizeof(Plane));
+    if (plane == NULL) return NULL;
+    plane->first = 0;
+    plane->nbins = nbins;
+    plane->values = malloc((nbins > 0 ? nbins : 1) * sizeof(uint16_t));
+    plane->valid = new_bitmap(nbins);
+    if (plane->values == NULL || plane->valid == NULL) {
+        del_plane(plane);
+        return NULL;
+    }
+    return plane;
+}
+
+/*
+ * Function:  del_plane
+ * --------------------
+ * Frees the plane, its values and its validity bitmap.
+ *
+ * args:
+ *      Plane *plane: the plane to free
+ */
+void del_plane(Plane *plane) {
+    if (plane == NULL) return;
+    free(plane->values);
+    free(plane->valid);
+    free(plane);
+}
+
+/*
+ * Function:  plane_from_ints
+ * --------------------
+ * Fills a plane starting at bin 0 from an array of data values with fill values marking bins without data. Values
+ * outside of 0 to levels - 1 are clamped to that range.
+ *
+ * args:
+ *      Plane *plane: the plane to fill
+ *      int *data: pointer to an array with a data value for each bin of the plane
+ *      int levels: the number of levels of the data, at most MAX_LEVELS
+ */
+void plane_from_ints(Plane *plane, const int *data, int levels) {
+    for (int w = 0; w < BITMAP_WORDS(plane->nbins); w++) plane->valid[w] = 0;
+    for (int i = 0; i < plane->nbins; i++) {
+        if (data[i] == FILL_VALUE) {
+            plane->values[i] = 0;
+        } else {
+            plane->values[i] = data[i] < 0 ? 0 : data[i] > levels - 1 ? levels - 1 : data[i];
+            bitmap_set(plane->valid, i);
+        }
+    }
+}
+
+/*
+ * Function:  plane_to_ints
+ * --------------------
+ * Writes the values of a plane starting at bin 0 to an array of data values, with fill values for invalid bins.
+ *
+ * args:
+ *      Plane *plane: the plane to read
+ *      int *data: pointer to output array with a value for each bin of the plane
+ */
+void plane_to_ints(const Plane *plane, int *data) {
+    for (int i = 0; i < plane->nbins; i++) {
+        data[i] = bitmap_get(plane->valid, i) ? plane->values[i] : FILL_VALUE;
+    }
+}
+
+/*
+ * Function:  plane_window
+ * --------------------
+ * Reads a window of data values from the plane given the first bin of each of its rows, as selected by
+ * grid_window_rows or get_window_rows, with fill values for invalid bins.
+ *
+ * args:
+ *      Plane *plane: the plane to read
+ *      int *first_bins: pointer to an array with the first bin of each row of the window
+ *      int width: the width of the window, at most 32
+ *      int *window: pointer to output array for the window. The array should be of width * width length
+ * returns:
+ *      int the number of fill values contained in the window
+ */
+int plane_window(const Plane *plane, const int *first_bins, int width, int window[]) {
+    int nfill_values = 0;
+    for (int i = 0; i < width; i++) {
+        const uint16_t *src = plane->values + first_bins[i] - plane->first;
+        uint32_t valid = bitmap_run(plane->valid, first_bins[i] - plane->first, width);
+        int *dst = window + i * width;
+        for (int j = 0; j < width; j++) {
+            int mask = -(int) ((valid >> j) & 1);    //All ones for valid bins, branch free
+            dst[j] = (src[j] & mask) | (FILL_VALUE & ~mask);
+            nfill_values += mask + 1;
+        }
+    }
+    return nfill_values;
+}
+
+/*
+ * Function:  grid_row
+ * --------------------
+ * Finds the row of a bin by bisecting the first bins of the rows.
+ *
+ * args:
+ *      Grid *grid: descriptor of the binning scheme
+ *      int bin: bin number of the bin of interest
+ * returns:
+ *      int the row number of the bin
+ */
+int grid_row(const Grid *grid, int bin) {
+    int low = 0;
+    int high = grid->nrows - 1;
+    while (low < high) {
+        int mid = (low + high + 1) >> 1;
+        if (grid->basebins[mid] <= bin) low = mid;
+        else high = mid - 1;
+    }
+    return low;
+}
+
+/*
+ * Function:  grid_neighbor
+ * --------------------
+ * Finds the bin nearest in position to the given bin in a row above or below it. Adjacent rows are looked up in the
+ * neighbor tables of the descriptor. Rows further away fall back to the ratio between the position of the bin and the
+ * length of its row, since chaining the adjacent lookups does not round the same way.
+ *
+ * args:
+ *      Grid *grid: descriptor of the binning scheme
+ *      int bin: bin number of the bin of interest
+ *      int row: the row number of the bin of interest
+ *      int drow: the number of rows between the bin of interest and the desired row. Negative values are north.
+ * returns:
+ *      int the bin number of the nearest bin in the desired row
+ */
+int grid_neighbor(const Grid *grid, int bin, int row, int drow) {
+    switch (drow) {
+        case 0:
+            return bin;
+        case -1:
+            return grid->basebins[row - 1] + grid->north[bin];
+        case 1:
+            return grid->basebins[row + 1] + grid->south[bin];
+        default:
+            return grid->basebins[row + drow] +
+                   neighbor_column(bin, row, row + drow, grid->nbins_in_row, grid->basebins);
+    }
+}
+
+/*
+ * Macro:  GRID_WINDOW_KERNEL
+ * --------------------
+ * Defines a window selection function specialized for a fixed odd or even width. With the width known at compile
+ * time the loop over the columns of each row is fully unrolled and fill values are counted without branching.
+ */
+#define GRID_WINDOW_KERNEL(W) \
+static int grid_window_##W(const Grid *grid, int bin, int row, const int *data, int window[]) { \
+    int nfill_values = 0; \
+    int offset = -(((W) - 1) >> 1); \
+    double ratio = ((double) bin - grid->basebins[row]) / grid->nbins_in_row[row]; \
+    _Pragma("GCC unroll 5") \
+    for (int i = 0; i < (W); i++) { \
+        int drow = offset + i; \
+        int first_bin; \
+        if (drow == 0) first_bin = bin; \
+        else if (drow == -1) first_bin = grid->basebins[row - 1] + grid->north[bin]; \
+        else if (drow == 1) first_bin = grid->basebins[row + 1] + grid->south[bin]; \
+        else first_bin = (int) (ratio * grid->nbins_in_row[row + drow] + 0.5) + grid->basebins[row + drow]; \
+        const int *src = data + first_bin + offset; \
+        _Pragma("GCC unroll 32") \
+        for (int j = 0; j < (W); j++) { \
+            window[i * (W) + j] = src[j]; \
+            nfill_values += src[j] == FILL_VALUE; \
+        } \
+    } \
+    return nfill_values; \
+}
+
+GRID_WINDOW_KERNEL(3)
+GRID_WINDOW_KERNEL(5)
+GRID_WINDOW_KERNEL(32)
+
+/*
+ * Function:  grid_window
+ * --------------------
+ * Selects a window of data values centered on a given bin with a given width using the neighbor tables of the
+ * descriptor. Produces the same window as get_window. The widths used by the algorithm, 3, 5 and WINDOW_WIDTH, are
+ * dispatched to specialized kernels.
+ *
+ * args:
+ *      Grid *grid: descriptor of the binning scheme
+ *      int bin: bin number of the center bin in the window. If the width of the window is even, then this is the upper
+ *      left bin in the center.
+ *      int row: the row number of the center bin. Row numbers begin with 0.
+ *      int width: the width of the desired window. Width must be a positive number greater than 2.
+ *      int *data: pointer to the array of data values to select from
+ *      int *window: pointer to output array for the window. The array should be of width * width length
+ * returns:
+ *      int the number of fill values contained in the window
+ */
+int grid_window(const Grid *grid, int bin, int row, int width, const int *data, int window[]) {
+    switch (width) {
+        case 3:
+            return grid_window_3(grid, bin, row, data, window);
+        case 5:
+            return grid_window_5(grid, bin, row, data, window);
+        case WINDOW_WIDTH:
+            return grid_window_32(grid, bin, row, data, window);
+        default:
+            break;
+    }
+    int nfill_values = 0;
+    int offset = -((width - 1) >> 1);   //Distance from the center to the first row and column of the window
+    for (int i = 0; i < width; i++) {
+        const int *src = data + grid_neighbor(grid, bin, row, offset + i) + offset;
+        for (int j = 0; j < width; j++) {
+            window[i * width + j] = src[j];
+            if (src[j] == FILL_VALUE) nfill_values++;
+        }
+    }
+    return nfill_values;
+}
+
+/*
+ * Function:  grid_bin_window
+ * --------------------
+ * Selects the bin numbers of a window centered on a given bin with a given width using the neighbor tables of the
+ * descriptor.
+ *
+ * args:
+ *      Grid *grid: descriptor of the binning scheme
+ *      int bin: bin number of the center bin in the window. If the width of the window is even, then this is the upper
+ *      left bin in the center.
+ *      int row: the row number of the center bin. Row numbers begin with 0.
+ *      int width: the width of the desired window. Width must be a positive number greater than 2.
+ *      int *window: pointer to output array for the bin numbers. The array should be of width * width length
+ */
+void grid_bin_window(const Grid *grid, int bin, int row, int width, int window[]) {
+    int offset = -((width - 1) >> 1);   //Distance from the center to the first row and column of the window
+    for (int i = 0; i < width; i++) {
+        int first_bin = grid_neighbor(grid, bin, row, offset + i) + offset;
+        for (int j = 0; j < width; j++) {
+            window[i * width + j] = first_bin + j;
+        }
+    }
+}
+
+/*
+ * Function:  grid_window_rows
+ * --------------------
+ * Selects the bin number of the first bin of each row of a window centered on a given bin with a given width. As the
+ * rows of a window are runs of consecutive bins, this describes the whole window. The ratio between the position of
+ * the bin and the length of its row is computed once for all rows further than one row away.
+ *
+ * args:
+ *      Grid *grid: descriptor of the binning scheme
+ *      int bin: bin number of the center bin in the window. If the width of the window is even, then this is the upper
+ *      left bin in the center.
+ *      int row: the row number of the center bin. Row numbers begin with 0.
+ *      int width: the width of the desired window. Width must be a positive number greater than 2.
+ *      int *first_bins: pointer to output array for the first bin of each row. The array should be of width length
+ */
+void grid_window_rows(const Grid *grid, int bin, int row, int width, int first_bins[]) {
+    int offset = -((width - 1) >> 1);   //Distance from the center to the first row and column of the window
+    double ratio = ((double) bin - grid->basebins[row]) / grid->nbins_in_row[row];
+    for (int i = 0; i < width; i++) {
+        int drow = offset + i;
+        int first_bin;
+        if (drow == 0) first_bin = bin;
+        else if (drow == -1) first_bin = grid->basebins[row - 1] + grid->north[bin];
+        else if (drow == 1) first_bin = grid->basebins[row + 1] + grid->south[bin];
+        else first_bin = (int) (ratio * grid->nbins_in_row[row + drow] + 0.5) + grid->basebins[row + drow];
+        first_bins[i] = first_bin + offset;
+    }
+}
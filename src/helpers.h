@@ -4,7 +4,108 @@
 
 #ifndef SIED_HELPERS_H
 #define SIED_HELPERS_H
+#include <stdint.h>
+
+/*
+ * Descriptor of the binning scheme of an area of interest. Built once with new_grid and shared by every stage that
+ * needs to find the neighbors of a bin. north and south hold, for each bin, the column of the nearest bin in the row
+ * above and below it so the neighbors of a bin can be found without recomputing the ratio between the position of the
+ * bin and the length of its row. Columns are stored as 16 bit integers, which limits rows to 32768 bins.
+ */
+typedef struct grid {
+    int nbins;
+    int nrows;
+    const int *nbins_in_row;
+    const int *basebins;
+    int16_t *north;
+    int16_t *south;
+} Grid;
+
+/*
+ * Data values of the bins of the binning scheme stored as 16 bit integers of up to MAX_LEVELS levels, with a packed
+ * bitmap holding one validity bit per bin in place of fill values. The value of a bin whose validity bit is clear is
+ * undefined. The bitmap has one word more than needed so that runs of bits can always be read from two consecutive
+ * words. A plane holds nbins bins starting at the bin first, which is a multiple of 64 so that bins keep the same
+ * position within the words of the bitmap. Planes of the whole binning scheme start at bin 0.
+ */
+typedef struct plane {
+    int first;
+    int nbins;
+    uint16_t *values;
+    uint64_t *valid;
+} Plane;
+
+#define MAX_LEVELS 4096
+#define BITMAP_WORDS(n) (((n) >> 6) + 2)
+
+static inline int bitmap_get(const uint64_t *bits, int i) {
+    return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void bitmap_set(uint64_t *bits, int i) {
+    bits[i >> 6] |= (uint64_t) 1 << (i & 63);
+}
+
+static inline void bitmap_clear(uint64_t *bits, int i) {
+    bits[i >> 6] &= ~((uint64_t) 1 << (i & 63));
+}
+
+/*
+ * Reads the 64 bits starting at bit i, the first bit in the lowest position.
+ */
+static inline uint64_t bitmap_word(const uint64_t *bits, int i) {
+    int shift = i & 63;
+    return bits[i >> 6] >> shift | (bits[(i >> 6) + 1] << 1) << (63 - shift);
+}
+
+/*
+ * Reads the n bits starting at bit i, with n at most 32, the first bit in the lowest position.
+ */
+static inline uint32_t bitmap_run(const uint64_t *bits, int i, int n) {
+    return (uint32_t) (bitmap_word(bits, i) & (((uint64_t) 1 << n) - 1));
+}
+
+/*
+ * Writes the n lowest bits of run to the n bits starting at bit i, with n at most 32.
+ */
+static inline void bitmap_write(uint64_t *bits, int i, int n, uint32_t run) {
+    int shift = i & 63;
+    uint64_t mask = ((uint64_t) 1 << n) - 1;
+    uint64_t *w = bits + (i >> 6);
+    w[0] = (w[0] & ~(mask << shift)) | ((uint64_t) run & mask) << shift;
+    if (shift + n > 64) w[1] = (w[1] & ~(mask >> (64 - shift))) | ((uint64_t) run & mask) >> (64 - shift);
+}
+
+/*
+ * Sets the bits among the n bits starting at bit i that are set in the n lowest bits of run, with n at most 32.
+ */
+static inline void bitmap_or(uint64_t *bits, int i, int n, uint32_t run) {
+    int shift = i & 63;
+    uint64_t r = (uint64_t) run & (((uint64_t) 1 << n) - 1);
+    uint64_t *w = bits + (i >> 6);
+    w[0] |= r << shift;
+    if (shift + n > 64) w[1] |= r >> (64 - shift);
+}
+
+static inline int plane_valid(const Plane *plane, int bin) {
+    return bitmap_get(plane->valid, bin - plane->first);
+}
+
+uint64_t * new_bitmap(int nbits);
+Plane * new_plane(int nbins);
+void del_plane(Plane *plane);
+void plane_from_ints(Plane *plane, const int *data, int levels);
+void plane_to_ints(const Plane *plane, int *data);
+int plane_window(const Plane *plane, const int *first_bins, int width, int window[]);
+Grid * new_grid(int nbins, int nrows, const int *nbins_in_row, const int *basebins);
+void del_grid(Grid *grid);
+int grid_row(const Grid *grid, int bin);
+int grid_neighbor(const Grid *grid, int bin, int row, int drow);
+int grid_window(const Grid *grid, int bin, int row, int width, const int *data, int window[]);
+void grid_bin_window(const Grid *grid, int bin, int row, int width, int window[]);
+void grid_window_rows(const Grid *grid, int bin, int row, int width, int first_bins[]);
 int get_window(int bin, int row, int width, const int *data, const int *n_bins_in_row,
                 const int *basebins, int window[]);
+void get_window_rows(int bin, int row, int width, const int *n_bins_in_row, const int *basebins, int first_bins[]);
 void get_bin_window(int bin, int row, int width, const int *n_bins_in_row, const int *basebins, int window[]);
 #endif //SIED_HELPERS_H
@@ -1,72 +1,187 @@
 /*
  * Functions for the implementation of the histogram analysis step of the single image edge detection algorithm.
  */
+#include <stdint.h>
 #include <string.h>
 #include "helpers.h"
 #include "histogram.h"
 #include "cayula.h"
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 
 
-#define CRIT_VALUE 0.7
-
-static inline double square(double a) {
-    return a * a;
-}
+#define CRIT_NUMERATOR 7
+#define CRIT_DENOMINATOR 10
+#define CRIT_VALUE ((double) CRIT_NUMERATOR / CRIT_DENOMINATOR)
+#define HISTOGRAM_BATCH 16
+#define CANDIDATE_PADDING 2
 
 static inline int squarei(int a) {
     return a * a;
 }
 
+#define HISTOGRAM_BANKS 2
+
 /*
  * Function: get_histogram
  * --------------------
  * Creates a histogram of the values in the window assuming the window contains integer values ranging from
- * 0 to 255.
+ * 0 to 255. Consecutive values are counted in HISTOGRAM_BANKS interleaved sub-histograms that are summed at the end,
+ * so runs of equal values, common in nearly uniform windows, do not wait on the previous increment of the same
+ * counter. A window holds at most WINDOW_AREA values, so the counters fit in 16 bits, which keeps the sub-histograms
+ * small to clear and lets them be summed 8 counters at a time. Fill values are excluded by adding zero rather than by
+ * branching, which keeps mixed windows free of mispredicted branches.
  *
  * args:
  *      int *data: the data contained within the window. Ranges from 0 to 255.
  *      int *histogram: pointer to a 256 element array for the output of the histogram
  */
 void get_histogram(const int *data, int *histogram) {
-    memset(histogram, 0, 256 * sizeof(int));
-    int area = squarei(WINDOW_WIDTH);
-    for (int i = 0; i < area; i++) {
-        if (data[i] != FILL_VALUE) {
-            histogram[data[i]]++;
+    uint16_t banks[HISTOGRAM_BANKS][256];
+    memset(banks, 0, sizeof(banks));
+    for (int i = 0; i < WINDOW_AREA; i += HISTOGRAM_BANKS) {
+        for (int k = 0; k < HISTOGRAM_BANKS; k++) {
+            int v = data[i + k];
+            banks[k][v & 0xff] += v != FILL_VALUE;
         }
     }
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    for (int v = 0; v < 256; v += 8) {
+        __m128i count = _mm_loadu_si128((const __m128i *) (banks[0] + v));
+        for (int k = 1; k < HISTOGRAM_BANKS; k++) {
+            count = _mm_add_epi16(count, _mm_loadu_si128((const __m128i *) (banks[k] + v)));
+        }
+        _mm_storeu_si128((__m128i *) (histogram + v), _mm_unpacklo_epi16(count, zero));
+        _mm_storeu_si128((__m128i *) (histogram + v + 4), _mm_unpackhi_epi16(count, zero));
+    }
+#else
+    for (int v = 0; v < 256; v++) {
+        int count = 0;
+        for (int k = 0; k < HISTOGRAM_BANKS; k++) count += banks[k][v];
+        histogram[v] = count;
+    }
+#endif
 }
 
 /*
- * Function:  within_group_variance
+ * Thresholds of a window worth evaluating. A threshold above a value missing from the window splits it like the
+ * threshold below and loses the tie to it, so only the thresholds just above the values present are kept, with the
+ * count and sum of the values below each. A window holds at most WINDOW_AREA distinct values whatever the number of
+ * levels. The arrays are padded with empty splits so they can be read CANDIDATE_PADDING at a time.
+ */
+struct candidates {
+    int n;
+    int sum;
+    int64_t sum_squares;
+    int ncandidates;
+    int threshold[WINDOW_AREA + CANDIDATE_PADDING];
+    int count[WINDOW_AREA + CANDIDATE_PADDING];
+    int first[WINDOW_AREA + CANDIDATE_PADDING];
+} typedef Candidates;
+
+/*
+ * Function:  pad_candidates
  * --------------------
- * Calculates the sum of the variance within the groups resulting from segmenting by the given threshold
+ * Pads the candidates with empty splits and stores the totals of the window.
  *
  * args:
- *      int *histogram: pointer to an array containing the histogram of the window
- *      double mu_low: mean of the group below the threshold
- *      double mu_high: mean of the group above the threshold
- *      int n_low: sum of the histogram of the group below the threshold
- *      int n_high: sum of the histogram of the group above the threshold
- *      int tau: the threshold
- * returns:
- *      double: the sum of the variance within the groups
+ *      Candidates *candidates: pointer to the candidates
+ *      int ncandidates: the number of candidates collected
+ *      int n: the number of valid values in the window
+ *      int sum: the sum of the valid values
+ *      int64_t sum_squares: the sum of the squares of the valid values
  */
-double within_group_variance(const int *histogram, double mu_low, double mu_high, int n_low, int n_high, int tau) {
-    double num = 0;
-    for (int i = 0; i < tau; i++) {
-        num += square(i - mu_low) * histogram[i];
+static void pad_candidates(Candidates *candidates, int ncandidates, int n, int sum, int64_t sum_squares) {
+    for (int k = ncandidates; k < ncandidates + CANDIDATE_PADDING; k++) {
+        candidates->count[k] = 0;
+        candidates->first[k] = 0;
     }
-    double s_low = num / n_low;
-    num = 0;
-    for (int i = tau; i < 256; i++) {
-        num += square(i - mu_high) * histogram[i];
+    candidates->n = n;
+    candidates->sum = sum;
+    candidates->sum_squares = sum_squares;
+    candidates->ncandidates = ncandidates;
+}
+
+/*
+ * Function: get_candidates
+ * --------------------
+ * Collects the candidate thresholds of a histogram and its count, sum and sum of squares.
+ *
+ * args:
+ *      int *histogram: pointer to a 256 element histogram
+ *      int levels: the number of levels of the data, at most 256. Thresholds run from 1 to levels - 2.
+ *      Candidates *candidates: pointer to the output candidates
+ */
+void get_candidates(const int *histogram, int levels, Candidates *candidates) {
+    int n = 0, sum = 0, sum_squares = 0, ncandidates = 0;
+    for (int i = 0; i < 256; i++) {
+        n += histogram[i];
+        sum += i * histogram[i];
+        sum_squares += squarei(i) * histogram[i];
+        candidates->threshold[ncandidates] = i + 1;
+        candidates->count[ncandidates] = n;
+        candidates->first[ncandidates] = sum;
+        ncandidates += histogram[i] != 0 && i < levels - 2;
     }
-    double s_high = num / n_high;
-    return (s_low * n_low / (n_low + n_high)) + (s_high * n_high / (n_low + n_high));
+    pad_candidates(candidates, ncandidates, n, sum, sum_squares);
 }
 
+/*
+ * Function: get_sorted_candidates
+ * --------------------
+ * Collects the candidate thresholds of a window directly from its values, for data with too many levels for a dense
+ * histogram to pay off. Values are counted in a histogram of all the levels that is only ever touched at the values
+ * present, listing each value the first time it is counted. The list of distinct values is sorted with two passes of
+ * a radix sort on 6 bits each, and the counts are read back and cleared in that order, so the cost depends on the
+ * number of values in the window and not on the number of levels.
+ *
+ * args:
+ *      int *window: pointer to an array containing the data values of the window
+ *      int levels: the number of levels of the data, at most MAX_LEVELS. Thresholds run from 1 to levels - 2.
+ *      int *counts: pointer to a MAX_LEVELS + 1 element array of zeros, which is left zeroed
+ *      Candidates *candidates: pointer to the output candidates
+ */
+void get_sorted_candidates(const int *window, int levels, int *counts, Candidates *candidates) {
+    int values[WINDOW_AREA], sorted[WINDOW_AREA];
+    int ndistinct = 0;
+    for (int i = 0; i < WINDOW_AREA; i++) {
+        int v = window[i];
+        int valid = v != FILL_VALUE;
+        //Fill values are counted in the extra last element, which is cleared below
+        values[ndistinct] = v;
+        ndistinct += (counts[valid ? v : MAX_LEVELS]++ == 0) & valid;
+    }
+    counts[MAX_LEVELS] = 0;
+    for (int shift = 0; shift < 12; shift += 6) {
+        int offsets[64] = {0};
+        for (int i = 0; i < ndistinct; i++) offsets[(values[i] >> shift) & 63]++;
+        for (int b = 0, total = 0; b < 64; b++) {
+            int count = offsets[b];
+            offsets[b] = total;
+            total += count;
+        }
+        for (int i = 0; i < ndistinct; i++) sorted[offsets[(values[i] >> shift) & 63]++] = values[i];
+        memcpy(values, sorted, ndistinct * sizeof(int));
+    }
+    int n = 0, sum = 0, ncandidates = 0;
+    int64_t sum_squares = 0;
+    for (int i = 0; i < ndistinct; i++) {
+        int v = values[i];
+        int count = counts[v];
+        counts[v] = 0;
+        n += count;
+        sum += v * count;
+        sum_squares += (int64_t) v * v * count;
+        candidates->threshold[ncandidates] = v + 1;
+        candidates->count[ncandidates] = n;
+        candidates->first[ncandidates] = sum;
+        ncandidates += v < levels - 2;
+    }
+    pad_candidates(candidates, ncandidates, n, sum, sum_squares);
+}
 
 /*
  * Function:  too_large
@@ -74,22 +189,142 @@ double within_group_variance(const int *histogram, double mu_low, double mu_high
  * Check to see if segmenting the window by the given threshold results in too small of a segment.
  *
  * args:
- *      int *histogram: pointer to an array containing a histogram of the values in the window
- *      int tau: the threshold by which to segment the window
+ *      int n_low: the number of values below the threshold
+ *      int n: the number of values in the window
  * returns:
  *      int: 1 if one of the segments is too large and 0 if both segments are of adequate size
  */
-int too_large(const int *histogram, int tau) {
-    int sum = 0;
-    int count = 0;
-    for (int i = 0; i < 256; i++) {
-        if (i < tau) {
-            sum += histogram[i];
+int too_large(int n_low, int n) {
+    return 4 * n_low < n || 4 * n_low > 3 * n;
+}
+
+/*
+ * Function:  rounded_between
+ * --------------------
+ * Calculates the between group variance of a threshold in double precision the way the histogram step always has. The
+ * rounding of this expression decided between thresholds of exactly equal between group variance.
+ *
+ * args:
+ *      Candidates *candidates: pointer to the candidate thresholds of the window
+ *      int k: the index of the candidate
+ * returns:
+ *      double: the between group variance
+ */
+static double rounded_between(const Candidates *candidates, int k) {
+    int n = candidates->n;
+    int n_low = candidates->count[k];
+    int n_high = n - n_low;
+    double mu_low = (double) candidates->first[k] / n_low;
+    double mu_high = (double) (candidates->sum - candidates->first[k]) / n_high;
+    return ((mu_low - mu_high) * (mu_low - mu_high) * n_low * n_high) / squarei(n);
+}
+
+#ifdef __SSE2__
+
+/*
+ * Function:  candidate_ratios
+ * --------------------
+ * Computes the ratio d * d / q of each candidate threshold, two candidates at a time. d and q are exact in double
+ * precision, so only their ratio is rounded.
+ *
+ * args:
+ *      Candidates *candidates: pointer to the candidate thresholds of the window
+ *      double *between: pointer to an array to write the ratio of each candidate
+ * returns:
+ *      double: the largest ratio, 0 if no candidate splits the window
+ */
+static double candidate_ratios(const Candidates *candidates, double *between) {
+    __m128d n = _mm_set1_pd(candidates->n);
+    __m128d sum = _mm_set1_pd(candidates->sum);
+    __m128d one = _mm_set1_pd(1);
+    __m128d max_between = _mm_setzero_pd();
+    for (int k = 0; k < candidates->ncandidates; k += 2) {
+        __m128d count = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i *) (candidates->count + k)));
+        __m128d first = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i *) (candidates->first + k)));
+        __m128d d = _mm_sub_pd(_mm_mul_pd(first, n), _mm_mul_pd(sum, count));
+        __m128d q = _mm_mul_pd(count, _mm_sub_pd(n, count));
+        __m128d ratio = _mm_div_pd(_mm_mul_pd(d, d), _mm_max_pd(q, one));
+        _mm_storeu_pd(between + k, ratio);
+        max_between = _mm_max_pd(max_between, ratio);
+    }
+    return _mm_cvtsd_f64(_mm_max_sd(max_between, _mm_unpackhi_pd(max_between, max_between)));
+}
+#else
+
+/*
+ * Function:  candidate_ratios
+ * --------------------
+ * Computes the ratio d * d / q of each candidate threshold.
+ *
+ * args:
+ *      Candidates *candidates: pointer to the candidate thresholds of the window
+ *      double *between: pointer to an array to write the ratio of each candidate
+ * returns:
+ *      double: the largest ratio, 0 if no candidate splits the window
+ */
+static double candidate_ratios(const Candidates *candidates, double *between) {
+    int n = candidates->n;
+    int sum = candidates->sum;
+    double max_between = 0;
+    for (int k = 0; k < candidates->ncandidates; k++) {
+        int64_t d = (int64_t) candidates->first[k] * n - (int64_t) sum * candidates->count[k];
+        int64_t q = (int64_t) candidates->count[k] * (n - candidates->count[k]);
+        between[k] = (double) d * d / (q > 0 ? q : 1);
+        if (between[k] > max_between) max_between = between[k];
+    }
+    return max_between;
+}
+#endif
+
+/*
+ * Function:  otsu_threshold
+ * --------------------
+ * Finds the threshold that maximizes the between group variance of the histogram of a window and scores the
+ * separation of the two groups it produces. For a threshold with n_low values summing to m_low below it, out of n
+ * values summing to sum, the between group variance is d * d / (n * n * q) with d = m_low * n - sum * n_low and
+ * q = n_low * (n - n_low), both exact integers. The total variance is v / (n * n) with v = n * M2 - sum * sum, so
+ * theta is d * d / (q * v) and the separation criterion is compared without rounding in integers.
+ *
+ * The ratios d * d / q of the candidate thresholds are computed with candidate_ratios, and the candidates within
+ * rounding of the largest ratio are then compared exactly in 128 bit integers. Exact ties, such as the two splits of a
+ * symmetric histogram, are broken by rounded_between so the same threshold is chosen as by the floating point sweep.
+ *
+ * args:
+ *      Candidates *candidates: pointer to the candidate thresholds of the window
+ *      double *theta: pointer to write the ratio of the between group variance to the total variance of the best
+ *      threshold, or 0 if no threshold splits the window
+ * returns:
+ *      int: the best threshold if it passes the size and separation criteria, otherwise -1
+ */
+static int otsu_threshold(const Candidates *candidates, double *theta) {
+    int n = candidates->n;
+    int sum = candidates->sum;
+    int ncandidates = candidates->ncandidates;
+    double between[WINDOW_AREA + CANDIDATE_PADDING];
+
+    double max_between = candidate_ratios(candidates, between);
+    *theta = 0;
+    if (max_between == 0) return -1;
+
+    int best = -1;
+    int64_t best_d = 0, best_q = 1;
+    for (int k = 0; k < ncandidates; k++) {
+        if (between[k] < max_between * (1 - 1e-12)) continue;
+        int64_t d = (int64_t) candidates->first[k] * n - (int64_t) sum * candidates->count[k];
+        int64_t q = (int64_t) candidates->count[k] * (n - candidates->count[k]);
+        __int128 lhs = (__int128) (d * d) * best_q, rhs = (__int128) (best_d * best_d) * q;
+        if (best < 0 || lhs > rhs ||
+            (lhs == rhs && rounded_between(candidates, k) > rounded_between(candidates, best))) {
+            best = k;
+            best_d = d;
+            best_q = q;
         }
-        count += histogram[i];
     }
-    double ratio = (double) sum / count;
-    return (ratio < 0.25 ||  ratio > 0.75);
+    int64_t v = (int64_t) n * candidates->sum_squares - (int64_t) sum * sum;
+    *theta = (double) (best_d * best_d) / ((double) best_q * v);
+    if (too_large(candidates->count[best], n)) return -1;
+    return (__int128) CRIT_DENOMINATOR * (best_d * best_d) >= (__int128) CRIT_NUMERATOR * best_q * v ?
+           candidates->threshold[best] : -1;
 }
 
 /*
@@ -106,41 +341,184 @@ int too_large(const int *histogram, int tau) {
  */
 int histogram_analysis(const int *window) {
     int histogram[256];
+    Candidates candidates;
+    double theta;
     get_histogram(window, histogram);
-    int n_low = 0, num_low = 0, n_high = 0, num_high = 0;
-    double max_between = 0;
-    for (int i = 0; i < 256; i++) {
-        n_high += histogram[i];
-        num_high += i * histogram[i];
-    }
-    int tau = -1;
-    double n_low_max, n_high_max, mu_high, mu_low_max, mu_low, mu_high_max;
-
-    for (int i = 0; i  < 254; i++) {
-        n_high -= histogram[i];
-        num_high -= i * histogram[i];
-        n_low += histogram[i];
-        num_low += (i) * histogram[i];
-        if (n_low != 0 && n_high != 0) {
-            mu_low = (double) num_low / n_low;
-            mu_high = (double) num_high / n_high;
-            double between = (square(mu_low - mu_high) * n_low * n_high) / squarei(n_low + n_high);
-
-            if (between > max_between) {
-                tau = i + 1;
-                max_between = between;
-                n_low_max = n_low;
-                n_high_max = n_high;
-                mu_low_max = mu_low;
-                mu_high_max = mu_high;
-            }
+    get_candidates(histogram, 256, &candidates);
+    return otsu_threshold(&candidates, &theta);
+}
+
+/*
+ * Count, sum, sum of squares and range of the valid values of a window.
+ */
+struct window_stats {
+    int n;
+    int sum;
+    int64_t sum_squares;
+    int low;
+    int high;
+} typedef WindowStats;
+
+#ifdef __SSE2__
+
+/*
+ * Function:  get_window_stats
+ * --------------------
+ * Computes the statistics of the valid values of a window. Values fit in 16 bits, so 8 values are packed into one
+ * vector at a time and summed in pairs into 32 bit lanes. The squares of up to MAX_LEVELS levels can overflow 32 bit
+ * lanes over the whole window, so their sums are carried over to 64 bit lanes every 64 values.
+ *
+ * args:
+ *      int *window: pointer to an array containing the data values of the window
+ *      WindowStats *stats: pointer to the output statistics
+ */
+static void get_window_stats(const int *window, WindowStats *stats) {
+    __m128i fill = _mm_set1_epi32(FILL_VALUE);
+    __m128i ones = _mm_set1_epi16(1);
+    __m128i above = _mm_set1_epi16(MAX_LEVELS);
+    __m128i n_invalid = _mm_setzero_si128(), sum = _mm_setzero_si128(), sum_squares = _mm_setzero_si128();
+    __m128i low = above, high = _mm_setzero_si128();
+    for (int block = 0; block < WINDOW_AREA; block += 64) {
+        __m128i block_squares = _mm_setzero_si128();
+        for (int i = block; i < block + 64; i += 8) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (window + i));
+            __m128i b = _mm_loadu_si128((const __m128i *) (window + i + 4));
+            __m128i invalid = _mm_packs_epi32(_mm_cmpeq_epi32(a, fill), _mm_cmpeq_epi32(b, fill));
+            __m128i masked = _mm_andnot_si128(invalid, _mm_packs_epi32(a, b));
+            n_invalid = _mm_sub_epi16(n_invalid, invalid);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(masked, ones));
+            block_squares = _mm_add_epi32(block_squares, _mm_madd_epi16(masked, masked));
+            low = _mm_min_epi16(low, _mm_or_si128(masked, _mm_and_si128(invalid, above)));
+            high = _mm_max_epi16(high, masked);
         }
+        sum_squares = _mm_add_epi64(sum_squares, _mm_unpacklo_epi32(block_squares, _mm_setzero_si128()));
+        sum_squares = _mm_add_epi64(sum_squares, _mm_unpackhi_epi32(block_squares, _mm_setzero_si128()));
+    }
+    int16_t n_lanes[8], low_lanes[8], high_lanes[8];
+    int32_t sum_lanes[4];
+    int64_t square_lanes[2];
+    _mm_storeu_si128((__m128i *) n_lanes, n_invalid);
+    _mm_storeu_si128((__m128i *) sum_lanes, sum);
+    _mm_storeu_si128((__m128i *) low_lanes, low);
+    _mm_storeu_si128((__m128i *) high_lanes, high);
+    _mm_storeu_si128((__m128i *) square_lanes, sum_squares);
+    *stats = (WindowStats) {WINDOW_AREA, 0, square_lanes[0] + square_lanes[1], MAX_LEVELS, 0};
+    for (int k = 0; k < 8; k++) {
+        stats->n -= n_lanes[k];
+        if (low_lanes[k] < stats->low) stats->low = low_lanes[k];
+        if (high_lanes[k] > stats->high) stats->high = high_lanes[k];
+    }
+    for (int k = 0; k < 4; k++) stats->sum += sum_lanes[k];
+}
+#else
 
+/*
+ * Function:  get_window_stats
+ * --------------------
+ * Computes the statistics of the valid values of a window.
+ *
+ * args:
+ *      int *window: pointer to an array containing the data values of the window
+ *      WindowStats *stats: pointer to the output statistics
+ */
+static void get_window_stats(const int *window, WindowStats *stats) {
+    *stats = (WindowStats) {0, 0, 0, MAX_LEVELS, 0};
+    for (int i = 0; i < WINDOW_AREA; i++) {
+        int v = window[i];
+        if (v == FILL_VALUE) continue;
+        stats->n++;
+        stats->sum += v;
+        stats->sum_squares += (int64_t) v * v;
+        if (v < stats->low) stats->low = v;
+        if (v > stats->high) stats->high = v;
     }
-    double theta = 0;
-    if (!too_large(histogram, tau)) {
-        double within = within_group_variance(histogram, mu_low_max, mu_high_max, n_low_max, n_high_max, tau);
-        theta = max_between / (max_between + within);
+}
+#endif
+
+/*
+ * Function:  cannot_split
+ * --------------------
+ * Screens a window from its count, range, mean and variance, which take a single pass over its data, for thresholds
+ * that could pass the size and separation criteria. A threshold that passes the size check leaves at least a quarter
+ * of the values in each group, so the difference d of the group means is at most the range and at most four times the
+ * distance of the mean to either end of the range. The between group variance is then at most d * d / 4, and the
+ * window cannot reach CRIT_VALUE when that is below CRIT_VALUE times the variance. This rejects flat windows and
+ * windows of a nearly uniform background with a few outliers without building their histograms.
+ *
+ * args:
+ *      int *window: pointer to an array containing the data values of the window
+ * returns:
+ *      int: 1 if no threshold of the window can pass, 0 if the histogram has to be analyzed
+ */
+static int cannot_split(const int *window) {
+    WindowStats stats;
+    get_window_stats(window, &stats);
+    int n = stats.n;
+    if (n == 0 || stats.high == stats.low) return 1;
+    double mu = (double) stats.sum / n;
+    double variance = ((double) n * stats.sum_squares - (double) stats.sum * stats.sum) / ((double) n * n);
+    double d = stats.high - stats.low;
+    if (4 * (mu - stats.low) < d) d = 4 * (mu - stats.low);
+    if (4 * (stats.high - mu) < d) d = 4 * (stats.high - mu);
+    //Only reject with a margin so rounding in the full analysis cannot disagree
+    return d * d / 4 < CRIT_VALUE * variance * (1 - 1e-9);
+}
+
+/*
+ * Function:  histogram_analysis_batch
+ * --------------------
+ * Performs the histogram step on consecutive windows. When no separation scores are asked for, windows are first
+ * screened with cannot_split, which only tells that a window fails. Otherwise every window is analyzed, so that the
+ * score of each is the same whether or not it could have been screened out. For data of at most 256 levels, the
+ * histograms of up to HISTOGRAM_BATCH remaining windows are built in one pass over their data before the thresholds
+ * of each are searched, so each stage runs as a tight loop over contiguous memory. For more levels the candidate
+ * thresholds of each window are found by sorting its values. The thresholds of 256 level data are the same as calling
+ * histogram_analysis on each window.
+ *
+ * args:
+ *      int *windows: pointer to nwindows consecutive WINDOW_WIDTH x WINDOW_WIDTH windows
+ *      int nwindows: the number of windows
+ *      int levels: the number of levels of the data, at most MAX_LEVELS
+ *      int *thresholds: pointer to an array of nwindows elements to write the threshold of each window, -1 for
+ *      windows without a front
+ *      double *thetas: pointer to an array of nwindows elements to write the separation score of the best threshold
+ *      of each window, 0 if no threshold splits it. May be NULL, which lets windows be screened out.
+ * returns:
+ *      int: the number of windows screened out before building their histograms
+ */
+int histogram_analysis_batch(const int *windows, int nwindows, int levels, int *thresholds, double *thetas) {
+    int histograms[HISTOGRAM_BATCH][256];
+    int batch[HISTOGRAM_BATCH];
+    int counts[MAX_LEVELS + 1];
+    Candidates candidates;
+    if (levels > 256) memset(counts, 0, sizeof(counts));
+    int skipped = 0;
+    int start = 0;
+    while (start < nwindows) {
+        int count = 0;
+        for (; start < nwindows && count < HISTOGRAM_BATCH; start++) {
+            if (thetas == NULL && cannot_split(windows + (size_t) start * WINDOW_AREA)) {
+                thresholds[start] = -1;
+                skipped++;
+            } else {
+                batch[count++] = start;
+            }
+        }
+        if (levels <= 256) {
+            for (int j = 0; j < count; j++) {
+                get_histogram(windows + (size_t) batch[j] * WINDOW_AREA, histograms[j]);
+            }
+        }
+        for (int j = 0; j < count; j++) {
+            double theta;
+            if (levels <= 256) {
+                get_candidates(histograms[j], levels, &candidates);
+            } else {
+                get_sorted_candidates(windows + (size_t) batch[j] * WINDOW_AREA, levels, counts, &candidates);
+            }
+            thresholds[batch[j]] = otsu_threshold(&candidates, &theta);
+            if (thetas != NULL) thetas[batch[j]] = theta;
+        }
     }
-    return theta >= CRIT_VALUE ? tau : -1;
-}
\ No newline at end of file
+    return skipped;
+}
@@ -5,5 +5,7 @@
 #ifndef SIED_HISTOGRAM_H
 #define SIED_HISTOGRAM_H
 double mean(const double *histogram, int threshold, bool high, int nvalues);
+void get_histogram(const int *data, int *histogram);
 int histogram_analysis(const int *window);
+int histogram_analysis_batch(const int *windows, int nwindows, int levels, int *thresholds, double *thetas);
 #endif //SIED_HISTOGRAM_H
@@ -0,0 +1,108 @@
+/*
+ * Functions for resampling latitude bands of the binning scheme into contiguous tiles for the window level steps of
+ * the single image edge detection algorithm.
+ */
+#include <stdlib.h>
+#include "tiles.h"
+#include "cayula.h"
+
+#define CACHE_LINE 64
+
+/*
+ * Function:  new_band
+ * --------------------
+ * Allocates a band large enough to hold the tiles of the longest row of the binning scheme.
+ *
+ * args:
+ *      Grid *grid: descriptor of the binning scheme
+ * returns:
+ *      Band *: the new band, or NULL if it could not be allocated
+ */
+Band * new_band(const Grid *grid) {
+    int max_row = 0;
+    for (int i = 0; i < grid->nrows; i++) {
+        if (grid->nbins_in_row[i] > max_row) max_row = grid->nbins_in_row[i];
+    }
+    Band *band = malloc(sizeof(Band));
+    if (band == NULL) return NULL;
+    band->row = -1;
+    band->ntiles = 0;
+    band->max_tiles = max_row / WINDOW_WIDTH + 1;
+    void *values = NULL;
+    if (posix_memalign(&values, CACHE_LINE, (size_t) band->max_tiles * WINDOW_AREA * sizeof(int)) != 0) values = NULL;
+    band->values = values;
+    band->first_bins = malloc(band->max_tiles * WINDOW_WIDTH * sizeof(int));
+    if (band->values == NULL || band->first_bins == NULL) {
+        del_band(band);
+        return NULL;
+    }
+    return band;
+}
+
+/*
+ * Function:  del_band
+ * --------------------
+ * Frees the band and its tiles.
+ *
+ * args:
+ *      Band *band: the band to free
+ */
+void del_band(Band *band) {
+    if (band == NULL) return;
+    free(band->values);
+    free(band->first_bins);
+    free(band);
+}
+
+/*
+ * Function:  load_band
+ * --------------------
+ * Fills the band with the windows centered on the given row. Windows are taken every WINDOW_WIDTH bins starting at
+ * the bin WINDOW_WIDTH / 2 - 1 of the row, which is how the histogram step walks each row. Each tile holds the same
+ * values as the window returned by grid_window for its center bin, with fill values for invalid bins. The bin number
+ * of the first bin of each tile row is recorded in the same pass, and as the rows of a window are runs of consecutive
+ * bins, the validity of each tile row is a single run of bits of the validity bitmap.
+ *
+ * args:
+ *      Band *band: the band to fill
+ *      Grid *grid: descriptor of the binning scheme
+ *      Plane *data: the data values to select from
+ *      int row: the row number of the center bins of the windows
+ * returns:
+ *      int: the number of tiles in the band
+ */
+int load_band(Band *band, const Grid *grid, const Plane *data, int row) {
+    int half_step = WINDOW_WIDTH / 2;
+    int ntiles = 0;
+    for (int j = half_step - 1; j < grid->nbins_in_row[row] - half_step; j += WINDOW_WIDTH) {
+        int *values = band->values + ntiles * WINDOW_AREA;
+        int *first_bins = band->first_bins + ntiles * WINDOW_WIDTH;
+        grid_window_rows(grid, grid->basebins[row] + j, row, WINDOW_WIDTH, first_bins);
+        plane_window(data, first_bins, WINDOW_WIDTH, values);
+        ntiles++;
+    }
+    band->row = row;
+    band->ntiles = ntiles;
+    return ntiles;
+}
+
+/*
+ * Function:  scatter_tile
+ * --------------------
+ * Sets the bits of a bitmap of the binning scheme for the set bits of a window of row masks computed from one of the
+ * tiles of the band, at the bins the tile was read from. Each tile row is a run of consecutive bins, so each row mask
+ * is merged into the bitmap at once. Clear bits leave the bitmap untouched.
+ *
+ * args:
+ *      Band *band: the band the window was computed from
+ *      int tile: the index of the tile in the band
+ *      uint32_t *rows: pointer to an array of WINDOW_WIDTH row masks to scatter, bit j of row k standing for column j
+ *      of row k of the tile
+ *      uint64_t *out: pointer to a bitmap with a bit for each bin in the binning scheme
+ */
+void scatter_tile(const Band *band, int tile, const uint32_t *rows, uint64_t *out) {
+    const int *first_bins = band->first_bins + tile * WINDOW_WIDTH;
+    for (int k = 0; k < WINDOW_WIDTH; k++) {
+        if (rows[k]) bitmap_or(out, first_bins[k], WINDOW_WIDTH, rows[k]);
+    }
+}
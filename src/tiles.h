@@ -0,0 +1,23 @@
+#ifndef SIED_TILES_H
+#define SIED_TILES_H
+#include "helpers.h"
+
+/*
+ * A latitude band of the binning scheme resampled into consecutive WINDOW_WIDTH x WINDOW_WIDTH tiles, one for each
+ * window of the histogram step centered on the row of the band. values holds the data of each tile row by row and is
+ * aligned to cache lines. Each tile row is a run of consecutive bins, so first_bins only holds the bin number of the
+ * first bin of each tile row, which is enough to scatter results computed on a tile back to the binning scheme.
+ */
+typedef struct band {
+    int row;
+    int ntiles;
+    int max_tiles;
+    int *values;
+    int *first_bins;
+} Band;
+
+Band * new_band(const Grid *grid);
+void del_band(Band *band);
+int load_band(Band *band, const Grid *grid, const Plane *data, int row);
+void scatter_tile(const Band *band, int tile, const uint32_t *rows, uint64_t *out);
+#endif //SIED_TILES_H
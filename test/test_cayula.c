@@ -1,4 +1,5 @@
 #include "unity.h"
+#include <stdlib.h>
 
 #include "cayula.h"
 #include "helpers.h"
@@ -6,6 +7,7 @@
 #include "contour.h"
 #include "filter.h"
 #include "histogram.h"
+#include "tiles.h"
 
 void setUp(void)
 {
@@ -1278,3 +1280,49 @@ void test_cayula_cayula(void)
     cayula(data, out, 16384, 128, nbins_in_row, basebins);
     TEST_ASSERT_EQUAL_INT(0, out[2300]);
 }
+
+void test_cayula_grid_12_bit(void) {
+    //A front at the largest 12 bit value, across the middle of a column of windows
+    int *data = malloc(16384 * sizeof(int));
+    int basebins[128];
+    int nbins_in_row[128];
+    for (int i = 0; i < 128; i++) {
+        basebins[i] = i * 128;
+        nbins_in_row[i] = 128;
+        for (int j = 0; j < 128; j++) {
+            data[i * 128 + j] = j < 48 ? 1000 + (i * 7 + j * 3) % 50 : 4095 - (i * 5 + j) % 3;
+        }
+    }
+    int *out = malloc(16384 * sizeof(int));
+    Grid *grid = new_grid(16384, 128, nbins_in_row, basebins);
+    cayula_grid(grid, data, out, 4096, 1, 0, 0);
+    int fronts = 0;
+    for (int i = 0; i < 16384; i++) {
+        TEST_ASSERT_TRUE(out[i] == 0 || out[i] == 1);
+        fronts += out[i];
+    }
+    TEST_ASSERT_TRUE(fronts > 0);
+    del_grid(grid);
+    free(data);
+    free(out);
+}
+
+void test_cayula_grid_levels_out_of_range(void) {
+    int data[1024];
+    int out[1024];
+    int basebins[32];
+    int nbins_in_row[32];
+    for (int i = 0; i < 32; i++) {
+        basebins[i] = i * 32;
+        nbins_in_row[i] = 32;
+    }
+    for (int i = 0; i < 1024; i++) data[i] = i % 5000;
+    Grid *grid = new_grid(1024, 32, nbins_in_row, basebins);
+    int levels[3] = {MAX_LEVELS + 1, 1, 0};
+    for (int k = 0; k < 3; k++) {
+        for (int i = 0; i < 1024; i++) out[i] = 0;
+        cayula_grid(grid, data, out, levels[k], 1, 0, 0);
+        for (int i = 0; i < 1024; i++) TEST_ASSERT_EQUAL_INT(-1, out[i]);
+    }
+    del_grid(grid);
+}
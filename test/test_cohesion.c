@@ -315,3 +315,68 @@ void test_cohesion_find_edge(void)
     TEST_ASSERT_EQUAL_INT_ARRAY(expected, output, 1024);
 }
 
+
+void test_cohesion_fill_values(void) {
+    int window[1024];
+    for (int i = 0; i < 1024; i++) {
+        int row = i / 32, col = i % 32;
+        window[i] = col < 16 ? 50 : 150;
+        if (col == 31 || row == 0 || (row * 7 + col) % 23 == 0) window[i] = FILL_VALUE;
+    }
+    TEST_ASSERT_EQUAL_INT(1, cohesive(window, 100));
+    //Alternating columns that shift every two rows leave half of the diagonal neighbors in the other group
+    for (int i = 0; i < 1024; i++) {
+        int row = i / 32, col = i % 32;
+        window[i] = (row / 2 + col) % 2 ? 50 : 150;
+    }
+    TEST_ASSERT_EQUAL_INT(0, cohesive(window, 100));
+}
+
+
+void test_cohesion_find_edge_mask(void) {
+    int window[1024];
+    for (int i = 0; i < 1024; i++) {
+        int col = i % 32;
+        window[i] = col < 16 ? 50 : 150;
+        if (col == 16) window[i] = FILL_VALUE;
+    }
+    //Fill values between the groups do not make edges
+    uint32_t rows[32];
+    find_edge_mask(window, 100, rows);
+    for (int i = 0; i < 32; i++) {
+        TEST_ASSERT_EQUAL_HEX32(0, rows[i]);
+    }
+    window[10 * 32 + 16] = 150;
+    find_edge_mask(window, 100, rows);
+    for (int i = 0; i < 32; i++) {
+        uint32_t expected = 0;
+        if (i == 9 || i == 11) expected = 1u << 15;
+        if (i == 10) expected = 3u << 15;
+        TEST_ASSERT_EQUAL_HEX32(expected, rows[i]);
+    }
+}
+
+
+void test_cohesion_find_cohesive_edge(void) {
+    int window[1024];
+    uint32_t rows[32], expected[32];
+    for (int i = 0; i < 1024; i++) {
+        int row = i / 32, col = i % 32;
+        window[i] = col < 16 + row % 3 ? 50 : 150;
+        if (col == 31 || (row * 7 + col) % 23 == 0) window[i] = FILL_VALUE;
+    }
+    find_edge_mask(window, 100, expected);
+    TEST_ASSERT_EQUAL_INT(1, find_cohesive_edge(window, 100, rows));
+    for (int i = 0; i < 32; i++) {
+        TEST_ASSERT_EQUAL_HEX32(expected[i], rows[i]);
+    }
+    //The rows are left untouched when the groups are not cohesive
+    for (int i = 0; i < 1024; i++) {
+        window[i] = (i / 32 / 2 + i % 32) % 2 ? 50 : 150;
+        rows[i % 32] = 7;
+    }
+    TEST_ASSERT_EQUAL_INT(0, find_cohesive_edge(window, 100, rows));
+    for (int i = 0; i < 32; i++) {
+        TEST_ASSERT_EQUAL_HEX32(7, rows[i]);
+    }
+}
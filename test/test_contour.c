@@ -2,7 +2,9 @@
 #include <stdlib.h>
 #include "contour.h"
 #include "helpers.h"
+#include "filter.h"
 
+const int FILL_VALUE = -999;
 
 void setUp(void) {
 }
@@ -10,6 +12,12 @@ void setUp(void) {
 void tearDown(void) {
 }
 
+static void bitmap_from_ints(uint64_t *bits, const int *data, int n) {
+    for (int i = 0; i < n; i++) {
+        if (data[i]) bitmap_set(bits, i);
+    }
+}
+
 void test_contour_gradient_ratio(void) {
     int arr[25] = { 50,  83, 100, 248, 118,
                     110,  67,  95, 168, 149,
@@ -19,62 +27,75 @@ void test_contour_gradient_ratio(void) {
     TEST_ASSERT_EQUAL_DOUBLE(0.3690171758724715, gradient_ratio(arr));
 }
 
-void test_contour_new_contour_point(void) {
-    ContourPoint prev = {4, 0, NULL, NULL};
-    ContourPoint *new_point = new_contour_point(&prev, 12, 0);
-    TEST_ASSERT_EQUAL_PTR(&prev, new_point->prev);
-    TEST_ASSERT_EQUAL_INT(12, new_point->bin);
-    TEST_ASSERT_EQUAL_INT(0, new_point->angle);
-    TEST_ASSERT_NULL(new_point->next);
-    free(new_point);
+void test_contour_add_contour_point(void) {
+    Contours *contours = new_contours();
+    TEST_ASSERT_EQUAL_INT(1, start_contour(contours, 4));
+    TEST_ASSERT_EQUAL_INT(1, add_contour_point(contours, 12, 90));
+    TEST_ASSERT_EQUAL_INT(1, start_contour(contours, 20));
+    TEST_ASSERT_EQUAL_INT(2, contours->ncontours);
+    TEST_ASSERT_EQUAL_INT(3, contours->npoints);
+    int offsets[3] = {0, 2, 3};
+    int bins[3] = {4, 12, 20};
+    int angles[3] = {0, 90, 0};
+    TEST_ASSERT_EQUAL_INT_ARRAY(offsets, contours->offsets, 3);
+    TEST_ASSERT_EQUAL_INT_ARRAY(bins, contours->bins, 3);
+    TEST_ASSERT_EQUAL_INT_ARRAY(angles, contours->angles, 3);
+    del_contours(contours);
+}
+
+void test_contour_contours_grow(void) {
+    Contours *contours = new_contours();
+    //Enough contours and points to grow the arrays several times
+    for (int i = 0; i < 1000; i++) {
+        TEST_ASSERT_EQUAL_INT(1, start_contour(contours, i * 100));
+        for (int k = 1; k < 100; k++) {
+            TEST_ASSERT_EQUAL_INT(1, add_contour_point(contours, i * 100 + k, 45));
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(1000, contours->ncontours);
+    TEST_ASSERT_EQUAL_INT(100000, contours->npoints);
+    for (int i = 0; i <= 1000; i++) {
+        TEST_ASSERT_EQUAL_INT(i * 100, contours->offsets[i]);
+    }
+    for (int k = 0; k < 100000; k++) {
+        TEST_ASSERT_EQUAL_INT(k, contours->bins[k]);
+    }
+    del_contours(contours);
 }
 
-void test_contour_del_contour(void) {
-    Contour *c1 = malloc(sizeof(Contour));
-    c1->prev = NULL;
-    c1->length = 12;
-    c1->first_point = NULL;
-    Contour *c2 = malloc(sizeof(Contour));
-    c1->next = c2;
-    c2->prev = c1;
-    c2->length = 10;
-    ContourPoint *point1 = malloc(sizeof(ContourPoint));
-    point1->bin = 10;
-    point1->prev = NULL;
-    point1->angle = 0;
-
-    ContourPoint *point2 = malloc(sizeof(ContourPoint));
-    point2->bin = 10;
-    point2->prev = point1;
-    point2->angle = 0;
-    point1->next = point2;
-
-    ContourPoint *point3 = malloc(sizeof(ContourPoint));
-    point3->bin = 10;
-    point3->prev = point2;
-    point3->angle = 0;
-    point2->next = point3;
-
-    ContourPoint *point4 = malloc(sizeof(ContourPoint));
-    point4->bin = 10;
-    point4->prev = point3;
-    point4->angle = 0;
-    point4->next = NULL;
-
-    c2->first_point = point1;
-
-    Contour *c3 = malloc(sizeof(Contour));
-    c2->next = c3;
-    c3->prev = c2;
-    c3->length = 4;
-    c3->first_point=NULL;
-
-    c2 = del_contour(c2);
-    TEST_ASSERT_EQUAL_PTR(c2, c3);
-    TEST_ASSERT_EQUAL_PTR(c1->next, c3);
-    TEST_ASSERT_EQUAL_PTR(c3->prev, c1);
+void test_contour_paint_contours(void) {
+    Contours *contours = new_contours();
+    start_contour(contours, 1);
+    add_contour_point(contours, 2, 0);
+    add_contour_point(contours, 3, 0);
+    contours->lengths[0] = 3;
+    start_contour(contours, 5);
+    add_contour_point(contours, 6, 0);
+    contours->lengths[1] = 1;
+    int out[8] = {0, 0, 0, 0, 0, 0, 0, -1};
+    int expected[8] = {0, 1, 1, 1, 0, 0, 0, -1};
+    paint_contours(contours, 3, out);
+    TEST_ASSERT_EQUAL_INT_ARRAY(expected, out, 8);
+    del_contours(contours);
 }
 
+void test_contour_turn_too_sharp(void) {
+    Contours *contours = new_contours();
+    start_contour(contours, 0);
+    add_contour_point(contours, 1, 0);
+    TEST_ASSERT_EQUAL_INT(0, turn_too_sharp(contours, 180));
+    add_contour_point(contours, 2, 0);
+    add_contour_point(contours, 3, 45);
+    TEST_ASSERT_EQUAL_INT(0, turn_too_sharp(contours, 90));
+    TEST_ASSERT_EQUAL_INT(1, turn_too_sharp(contours, 135));
+    TEST_ASSERT_EQUAL_INT(1, turn_too_sharp(contours, 270));
+    TEST_ASSERT_EQUAL_INT(0, turn_too_sharp(contours, 315));
+    for (int i = 0; i < 5; i++) add_contour_point(contours, 4 + i, 90);
+    //Only the last five directions are compared
+    TEST_ASSERT_EQUAL_INT(0, turn_too_sharp(contours, 180));
+    TEST_ASSERT_EQUAL_INT(1, turn_too_sharp(contours, 225));
+    del_contours(contours);
+}
 
 void test_contour_find_best_front(void) {
     int data[81] = {
@@ -94,34 +115,35 @@ void test_contour_find_best_front(void) {
         basebins[i] = i * 9;
         nbins_in_row[i] = 9;
     }
-    ContourPoint point = {13, 1, NULL, NULL};
-    ContourPoint *point2 = find_best_front(&point, data, 1, basebins, nbins_in_row);
+    uint64_t edges[BITMAP_WORDS(81)] = {0};
+    bitmap_from_ints(edges, data, 81);
+    Grid *grid = new_grid(81, 9, nbins_in_row, basebins);
+    Contours *contours = new_contours();
+    start_contour(contours, 13);
+    TEST_ASSERT_EQUAL_INT(1, find_best_front(contours, edges, 1, grid));
 
-    TEST_ASSERT_EQUAL_INT(22, point2->bin);
-    TEST_ASSERT_EQUAL_INT(270, point2->angle);
+    TEST_ASSERT_EQUAL_INT(22, contours->bins[1]);
+    TEST_ASSERT_EQUAL_INT(270, contours->angles[1]);
 
-    ContourPoint *point3 = find_best_front(point2, data, 2, basebins, nbins_in_row);
-    TEST_ASSERT_EQUAL_INT(31, point3->bin);
-    TEST_ASSERT_EQUAL_INT(270, point3->angle);
+    TEST_ASSERT_EQUAL_INT(1, find_best_front(contours, edges, 2, grid));
+    TEST_ASSERT_EQUAL_INT(31, contours->bins[2]);
+    TEST_ASSERT_EQUAL_INT(270, contours->angles[2]);
 
-    ContourPoint *point4 = find_best_front(point3, data, 3, basebins, nbins_in_row);
+    TEST_ASSERT_EQUAL_INT(1, find_best_front(contours, edges, 3, grid));
 
-    TEST_ASSERT_EQUAL_INT(39, point4->bin);
-    TEST_ASSERT_EQUAL_INT(225, point4->angle);
+    TEST_ASSERT_EQUAL_INT(39, contours->bins[3]);
+    TEST_ASSERT_EQUAL_INT(225, contours->angles[3]);
 
-    ContourPoint *point5 = find_best_front(point4, data, 4, basebins, nbins_in_row);
+    TEST_ASSERT_EQUAL_INT(1, find_best_front(contours, edges, 4, grid));
 
-    TEST_ASSERT_EQUAL_INT(38, point5->bin);
-    TEST_ASSERT_EQUAL_INT(180, point5->angle);
+    TEST_ASSERT_EQUAL_INT(38, contours->bins[4]);
+    TEST_ASSERT_EQUAL_INT(180, contours->angles[4]);
 
-    ContourPoint *point6 = find_best_front(point5, data, 4, basebins, nbins_in_row);
-    TEST_ASSERT_NULL(point6);
+    TEST_ASSERT_EQUAL_INT(0, find_best_front(contours, edges, 4, grid));
+    TEST_ASSERT_EQUAL_INT(5, contours->npoints);
 
-    while (point2->next != NULL) {
-        ContourPoint *tmp = point2->next;
-        free(point2);
-        point2 = tmp;
-    }
+    del_contours(contours);
+    del_grid(grid);
 }
 
 void test_contour_follow_contour(void) {
@@ -153,25 +175,161 @@ void test_contour_follow_contour(void) {
             100, 100, 100, 100, 100, 100, 100, 100, 100,
             100, 100, 100, 100, 100, 100, 100, 100, 100
     };
-    int pixel_in_contour[81] = { 0 };
-    pixel_in_contour[13] = 1;
-    ContourPoint point = {13, 1, NULL, NULL};
-    int count = follow_contour(&point, data, filtered_data, pixel_in_contour, 1, 9, basebins, nbins_in_row);
-
-    ContourPoint *pt = point.next;
-    ContourPoint *tmp;
-    int c = 0;
-    while (tmp->next != NULL) {
-        tmp = pt->next;
-        free(pt);
-        pt = tmp;
-        c++;
-    }
+    uint64_t edges[BITMAP_WORDS(81)] = {0};
+    bitmap_from_ints(edges, data, 81);
+    Plane *filtered = new_plane(81);
+    plane_from_ints(filtered, filtered_data, 256);
+    uint64_t pixel_in_contour[BITMAP_WORDS(81)] = {0};
+    bitmap_set(pixel_in_contour, 13);
+    Contours *contours = new_contours();
+    start_contour(contours, 13);
+    Grid *grid = new_grid(81, 9, nbins_in_row, basebins);
+    int count = follow_contour(contours, edges, filtered, 0, pixel_in_contour, 1, grid);
+    del_grid(grid);
+    del_plane(filtered);
+
     TEST_ASSERT_EQUAL_INT(6, count);
-    TEST_ASSERT_EQUAL_INT(1, pixel_in_contour[28]);
-    TEST_ASSERT_EQUAL_INT(28, pt->bin);
-    free(pt);
+    TEST_ASSERT_EQUAL_INT(1, bitmap_get(pixel_in_contour, 28));
+    TEST_ASSERT_EQUAL_INT(28, contours->bins[contours->npoints - 1]);
+    del_contours(contours);
 }
+void test_contour_follow_contour_long_front(void) {
+    //A straight front running down a column of 100000 rows, as long as the whole contour can be
+    int nrows = 100003;
+    int width = 8;
+    int *basebins = malloc(nrows * sizeof(int));
+    int *nbins_in_row = malloc(nrows * sizeof(int));
+    for (int i = 0; i < nrows; i++) {
+        basebins[i] = i * width;
+        nbins_in_row[i] = width;
+    }
+    int nbins = nrows * width;
+    uint64_t *edges = new_bitmap(nbins);
+    uint64_t *pixel_in_contour = new_bitmap(nbins);
+    for (int i = 2; i < nrows; i++) {
+        bitmap_set(edges, basebins[i] + 4);
+    }
+    Plane *filtered = new_plane(nbins);
+    Grid *grid = new_grid(nbins, nrows, nbins_in_row, basebins);
+    bitmap_set(pixel_in_contour, basebins[2] + 4);
+    Contours *contours = new_contours();
+    start_contour(contours, basebins[2] + 4);
+    int count = follow_contour(contours, edges, filtered, 0, pixel_in_contour, 2, grid);
+    TEST_ASSERT_EQUAL_INT(100000, count);
+    TEST_ASSERT_EQUAL_INT(100000, contours->npoints);
+
+    for (int k = 1; k < contours->npoints; k++) {
+        TEST_ASSERT_EQUAL_INT(basebins[k + 2] + 4, contours->bins[k]);
+        TEST_ASSERT_EQUAL_INT(270, contours->angles[k]);
+        TEST_ASSERT_EQUAL_INT(1, bitmap_get(pixel_in_contour, contours->bins[k]));
+    }
+
+    del_contours(contours);
+    del_grid(grid);
+    del_plane(filtered);
+    free(edges);
+    free(pixel_in_contour);
+    free(basebins);
+    free(nbins_in_row);
+}
+
+static void assert_contours_equal(const Contours *expected, const Contours *actual) {
+    TEST_ASSERT_EQUAL_INT(expected->ncontours, actual->ncontours);
+    TEST_ASSERT_EQUAL_INT(expected->npoints, actual->npoints);
+    for (int i = 0; i < expected->ncontours; i++) {
+        TEST_ASSERT_EQUAL_INT(expected->offsets[i + 1], actual->offsets[i + 1]);
+        TEST_ASSERT_EQUAL_INT(expected->lengths[i], actual->lengths[i]);
+    }
+    for (int k = 0; k < expected->npoints; k++) {
+        TEST_ASSERT_EQUAL_INT(expected->bins[k], actual->bins[k]);
+        TEST_ASSERT_EQUAL_INT(expected->angles[k], actual->angles[k]);
+    }
+}
+
+void test_contour_trace_contours_tiled(void) {
+    //Fronts running across several bands of rows, which have to be stitched back together
+    int nrows = 600;
+    int width = 200;
+    int *basebins = malloc(nrows * sizeof(int));
+    int *nbins_in_row = malloc(nrows * sizeof(int));
+    for (int i = 0; i < nrows; i++) {
+        basebins[i] = i * width;
+        nbins_in_row[i] = width;
+    }
+    int nbins = nrows * width;
+    uint64_t *edges = new_bitmap(nbins);
+    for (int i = 2; i < nrows; i++) {
+        bitmap_set(edges, basebins[i] + 50);
+    }
+    for (int i = 10; i < 500; i++) {
+        bitmap_set(edges, basebins[i] + 60 + i / 4);
+    }
+    for (int j = 150; j < 190; j++) {
+        bitmap_set(edges, basebins[300] + j);
+    }
+    Plane *filtered = new_plane(nbins);
+    for (int k = 0; k < nbins; k++) filtered->values[k] = 0;
+    for (int w = 0; w < BITMAP_WORDS(nbins); w++) filtered->valid[w] = ~0ULL;
+    Grid *grid = new_grid(nbins, nrows, nbins_in_row, basebins);
+
+    Contours *expected = trace_contours(edges, filtered, 0, NULL, grid);
+    Contours *single = trace_contours_tiled(edges, filtered, 0, NULL, grid, 1);
+    Contours *multiple = trace_contours_tiled(edges, filtered, 0, NULL, grid, 4);
+    assert_contours_equal(expected, single);
+    assert_contours_equal(single, multiple);
+    TEST_ASSERT_EQUAL_INT(nrows - 3, expected->lengths[0]);
+
+    del_contours(expected);
+    del_contours(single);
+    del_contours(multiple);
+    del_grid(grid);
+    del_plane(filtered);
+    free(edges);
+    free(basebins);
+    free(nbins_in_row);
+}
+
+void test_contour_gradient_rows(void) {
+    int nrows = 6;
+    //Rows long enough to be split into runs, with the fill values of the map as margins for the 3x3 windows
+    int nbins_in_row[6] = {5, 70, 90, 90, 70, 5};
+    int basebins[6] = {0, 5, 75, 165, 255, 325};
+    int nbins = 330;
+    int pad = 4;
+    int values[338];
+    for (int i = 0; i < nbins + 2 * pad; i++) values[i] = FILL_VALUE;
+    int *data = values + pad;
+    for (int i = 0; i < nbins; i++) {
+        data[i] = i % 7 == 3 ? FILL_VALUE : (i * 37) % 200;
+    }
+    Plane *filtered = new_plane(nbins);
+    plane_from_ints(filtered, data, 256);
+    Grid *grid = new_grid(nbins, nrows, nbins_in_row, basebins);
+    GradientField *gradients = new_gradient_field(nbins);
+    gradient_rows(gradients, filtered, grid, 0, nrows);
+
+    for (int i = 0; i < nrows; i++) {
+        for (int bin = basebins[i]; bin < basebins[i] + nbins_in_row[i]; bin++) {
+            int x = 0, y = 0;
+            if (i > 0 && i < nrows - 1) {
+                int window[9];
+                grid_window(grid, bin, i, 3, data, window);
+                for (int k = 1; k < 9; k += 2) {
+                    if (window[k] == FILL_VALUE) window[k] = window[4];
+                }
+                x = window[5] - window[3];
+                y = window[7] - window[1];
+            }
+            TEST_ASSERT_EQUAL_INT(x, gradients->x[bin]);
+            TEST_ASSERT_EQUAL_INT(y, gradients->y[bin]);
+        }
+    }
+
+    del_gradient_field(gradients);
+    del_grid(grid);
+    del_plane(filtered);
+}
+
 /*
 void test_contour_NeedToImplement(void)
 {
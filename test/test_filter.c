@@ -10,6 +10,20 @@ void setUp(void) {
 
 void tearDown(void) {
 }
+
+static void filter_ints(int *data, int *filtered_data, const Grid *grid, int width, int nthreads) {
+    Plane *plane = new_plane(grid->nbins);
+    Plane *filtered = new_plane(grid->nbins);
+    plane_from_ints(plane, data, 256);
+    if (width == 3) {
+        median_filter(plane, filtered, grid, nthreads);
+    } else {
+        median_filter_kernel(plane, filtered, grid, width, nthreads);
+    }
+    plane_to_ints(filtered, filtered_data);
+    del_plane(plane);
+    del_plane(filtered);
+}
 /*
 void test_filter_median9(void) {
     int arr[9] = {144,233,178,102, 72, 1, 52, 246, 254};
@@ -71,7 +85,64 @@ void test_filter_median_filter_no_fill(void) {
                              FILL_VALUE, 88,  55,  83,  98, 105, 188, 162, 162, 151,  93, FILL_VALUE,
                              FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE,
                              FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE};
-    median_filter(arr, filtered_data, nbins, nrows, nbins_in_row, basebins);
+    Grid *grid = new_grid(nbins, nrows, nbins_in_row, basebins);
+    filter_ints(arr, filtered_data, grid, 3, 1);
+    del_grid(grid);
+    TEST_ASSERT_EQUAL_INT_ARRAY(arr_expected, filtered_data, 144);
+}
+
+void test_filter_median_filter_12_bit(void) {
+
+    int arr[144] = {148, 66, 169, 185, 255, 241, 84, 41, 80, 100, 136, 74,
+                    245, 216, 38, 110, 127, 2, 203, 152, 248, 44, 237, 23,
+                    134, 99, 227, 186, 19, 173, 179, 51, 139, 89, 4, 132,
+                    141, 48, 221, 232, 72, 50, 166, 187, 11, 76, 189, 194,
+                    181, 45, 17, 195, 53, 121, 252, 164, 39, 57, 242, 118,
+                    153, 6, 150, 226, 113, 202, 233, 133, 230, 160, 149, 222,
+                    155, 211, 171, 31, 97, 8, 49, 123, 78, 95, 157, 63,
+                    128, 183, 234, 62, 138, 143, 71, 126, 147, 239, 101, 199,
+                    7, 26, 3, 58, 207, 35, 122, 40, 129, 34, 5, 33,
+                    115, 1, 42, 83, 75, 244, 188, 214, 146, 212, 93, 156,
+                    112, 55, 246, 47, 105, 98, 92, 228, 162, 158, 59, 27,
+                    114, 88, 29, 193, 180, 24, 204, 32, 151, 191, 54, 13};
+
+
+    int filtered_data[144];
+    int nbins = 144;
+    int nrows = 12;
+    int nbins_in_row[12] = {12,12,12,12,12,12,12,12,12,12,12,12};
+    int basebins[12];
+    for (int i = 0; i < 12; i++) {
+        basebins[i] = (i * 12);
+    }
+    int arr_expected[144] = {FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE,
+                             FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE,
+                             FILL_VALUE,148, 169, 169, 173, 173, 152, 139,  89, 100,  89, FILL_VALUE ,
+                             FILL_VALUE, 141, 186, 127, 110, 127, 166, 166,  89,  89,  89, FILL_VALUE,
+                             FILL_VALUE, 134, 186, 186, 121, 121, 166, 164,  76,  76, 118, FILL_VALUE,
+                             FILL_VALUE, 141, 150, 150, 121, 121, 166, 166, 133, 149, 160, FILL_VALUE,
+                             FILL_VALUE, 153, 150, 113, 113, 113, 133, 133, 123, 149, 149, FILL_VALUE,
+                             FILL_VALUE, 155, 171, 138, 113, 113, 126, 126, 133, 149, 157, FILL_VALUE,
+                             FILL_VALUE, 155,  62,  97,  62,  97,  71, 122, 123, 101,  95, FILL_VALUE,
+                             FILL_VALUE, 42,  58,  75,  83, 138, 126, 129, 146, 129, 101, FILL_VALUE,
+                             FILL_VALUE, 42,  47,  75,  83, 105, 122, 146, 158, 129,  59, FILL_VALUE,
+                             FILL_VALUE, 88,  55,  83,  98, 105, 188, 162, 162, 151,  93, FILL_VALUE,
+                             FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE,
+                             FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE};
+    //Every window is full, so the median of values scaled to 12 bits is the scaled median
+    for (int i = 0; i < 144; i++) {
+        arr[i] = arr[i] * 16 + 15;
+        if (arr_expected[i] != FILL_VALUE) arr_expected[i] = arr_expected[i] * 16 + 15;
+    }
+    Grid *grid = new_grid(nbins, nrows, nbins_in_row, basebins);
+    Plane *plane = new_plane(nbins);
+    Plane *filtered = new_plane(nbins);
+    plane_from_ints(plane, arr, 4096);
+    median_filter(plane, filtered, grid, 1);
+    plane_to_ints(filtered, filtered_data);
+    del_plane(plane);
+    del_plane(filtered);
+    del_grid(grid);
     TEST_ASSERT_EQUAL_INT_ARRAY(arr_expected, filtered_data, 144);
 }
 
@@ -113,7 +184,156 @@ void test_filter_median_filter_yes_fill(void) {
                              FILL_VALUE, 88,  55,  83,  98, 105, 188, 162, 162, 151,  93, FILL_VALUE,
                              FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE,
                              FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE, FILL_VALUE};
-    median_filter(arr, filtered_data, nbins, nrows, nbins_in_row, basebins);
+    Grid *grid = new_grid(nbins, nrows, nbins_in_row, basebins);
+    filter_ints(arr, filtered_data, grid, 3, 1);
+    del_grid(grid);
     TEST_ASSERT_EQUAL_INT_ARRAY(arr_expected, filtered_data, 144);
 }
 
+
+static int compare_int(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
+}
+
+void test_filter_median_filter_uneven_rows(void) {
+    int nrows = 12;
+    int nbins_in_row[12] = {20, 24, 29, 33, 36, 38, 38, 36, 33, 29, 24, 20};
+    int basebins[12];
+    int nbins = 0;
+    for (int i = 0; i < nrows; i++) {
+        basebins[i] = nbins;
+        nbins += nbins_in_row[i];
+    }
+    int data[360];
+    int filtered_data[360];
+    for (int i = 0; i < nbins; i++) {
+        data[i] = i % 13 == 5 ? FILL_VALUE : (i * 97 + 31) % 256;
+    }
+    Grid *grid = new_grid(nbins, nrows, nbins_in_row, basebins);
+    filter_ints(data, filtered_data, grid, 3, 1);
+
+    for (int i = 1; i < nrows - 1; i++) {
+        for (int j = basebins[i] + 1; j < basebins[i] + nbins_in_row[i] - 1; j++) {
+            int window[9];
+            int n_invalid = get_window(j, i, 3, data, nbins_in_row, basebins, window);
+            qsort(window, 9, sizeof(int), compare_int);
+            int n = 9 - n_invalid;
+            int *valid = window + n_invalid;
+            int expected = n & 1 ? valid[n >> 1] : (valid[n >> 1] + valid[(n >> 1) - 1] + 1) >> 1;
+            if (data[j] == FILL_VALUE) expected = FILL_VALUE;
+            TEST_ASSERT_EQUAL_INT(expected, filtered_data[j]);
+        }
+    }
+    int threaded_data[360];
+    for (int nthreads = 2; nthreads <= 16; nthreads *= 2) {
+        filter_ints(data, threaded_data, grid, 3, nthreads);
+        TEST_ASSERT_EQUAL_INT_ARRAY(filtered_data, threaded_data, nbins);
+    }
+    del_grid(grid);
+}
+
+void test_filter_median_filter_kernel(void) {
+    int nrows = 20;
+    int nbins_in_row[20];
+    int basebins[20];
+    int nbins = 0;
+    for (int i = 0; i < nrows; i++) {
+        nbins_in_row[i] = 40 + (i < 10 ? i : 19 - i) * 3;
+        basebins[i] = nbins;
+        nbins += nbins_in_row[i];
+    }
+    int *data = malloc(nbins * sizeof(int));
+    int *filtered_data = malloc(nbins * sizeof(int));
+    int *threaded_data = malloc(nbins * sizeof(int));
+    for (int i = 0; i < nbins; i++) {
+        data[i] = i % 11 == 3 || i % 17 == 0 ? FILL_VALUE : (i * 89 + 7) % 256;
+    }
+    Grid *grid = new_grid(nbins, nrows, nbins_in_row, basebins);
+
+    for (int width = 5; width <= 7; width += 2) {
+        int r = width / 2;
+        filter_ints(data, filtered_data, grid, width, 1);
+        for (int i = 0; i < nrows; i++) {
+            for (int j = basebins[i]; j < basebins[i] + nbins_in_row[i]; j++) {
+                int expected = FILL_VALUE;
+                double ratio = (double) (j - basebins[i]) / nbins_in_row[i];
+                int inside = i >= r && i < nrows - r &&
+                             (int) (ratio * nbins_in_row[i - r] + 0.5) + basebins[i - r] - r >= 0 &&
+                             (int) (ratio * nbins_in_row[i + r] + 0.5) + basebins[i + r] + r < nbins;
+                if (inside && j >= basebins[i] + r && j < basebins[i] + nbins_in_row[i] - r && data[j] != FILL_VALUE) {
+                    int window[49];
+                    int n_invalid = get_window(j, i, width, data, nbins_in_row, basebins, window);
+                    qsort(window, width * width, sizeof(int), compare_int);
+                    int n = width * width - n_invalid;
+                    int *valid = window + n_invalid;
+                    expected = n & 1 ? valid[n >> 1] : (valid[n >> 1] + valid[(n >> 1) - 1] + 1) >> 1;
+                }
+                TEST_ASSERT_EQUAL_INT(expected, filtered_data[j]);
+            }
+        }
+        filter_ints(data, threaded_data, grid, width, 4);
+        TEST_ASSERT_EQUAL_INT_ARRAY(filtered_data, threaded_data, nbins);
+    }
+    del_grid(grid);
+    free(data);
+    free(filtered_data);
+    free(threaded_data);
+}
+
+struct stream_check {
+    const Grid *grid;
+    const int *expected;
+    int window_rows;
+    int next_row;
+    int mismatches;
+} typedef StreamCheck;
+
+static void check_rows(void *context, const Plane *rows, int row) {
+    StreamCheck *check = context;
+    const Grid *grid = check->grid;
+    if (row != check->next_row++) check->mismatches++;
+    int first_row = row - check->window_rows + 1 > 0 ? row - check->window_rows + 1 : 0;
+    for (int j = grid->basebins[first_row]; j < grid->basebins[row] + grid->nbins_in_row[row]; j++) {
+        int value = bitmap_get(rows->valid, j - rows->first) ? rows->values[j - rows->first] : FILL_VALUE;
+        if (value != check->expected[j]) check->mismatches++;
+    }
+}
+
+void test_filter_median_filter_stream(void) {
+    int nrows = 40;
+    int nbins_in_row[40];
+    int basebins[40];
+    int nbins = 0;
+    for (int i = 0; i < nrows; i++) {
+        nbins_in_row[i] = 30 + (i < 20 ? i : 39 - i) * 4;
+        basebins[i] = nbins;
+        nbins += nbins_in_row[i];
+    }
+    int *data = malloc(nbins * sizeof(int));
+    int *filtered_data = malloc(nbins * sizeof(int));
+    for (int i = 0; i < nbins; i++) {
+        data[i] = i % 23 == 7 ? FILL_VALUE : (i * 61 + 11) % 256;
+    }
+    Grid *grid = new_grid(nbins, nrows, nbins_in_row, basebins);
+    filter_ints(data, filtered_data, grid, 3, 1);
+    Plane *plane = new_plane(nbins);
+    plane_from_ints(plane, data, 256);
+
+    for (int nthreads = 1; nthreads <= 4; nthreads += 3) {
+        for (int window_rows = 1; window_rows <= 7; window_rows += 3) {
+            StreamCheck check = {grid, filtered_data, window_rows, 0, 0};
+            TEST_ASSERT_EQUAL_INT(1, median_filter_stream(plane, grid, window_rows, nthreads, check_rows, &check));
+            TEST_ASSERT_EQUAL_INT(nrows, check.next_row);
+            TEST_ASSERT_EQUAL_INT(0, check.mismatches);
+        }
+    }
+    for (int i = 0; i < nrows; i++) {
+        for (int j = basebins[i]; j < basebins[i] + nbins_in_row[i]; j++) {
+            TEST_ASSERT_EQUAL_INT(filtered_data[j], median_filter_bin(plane, grid, j, i));
+        }
+    }
+    del_plane(plane);
+    del_grid(grid);
+    free(data);
+    free(filtered_data);
+}
@@ -1,5 +1,7 @@
 #include "unity.h"
 
+#include <math.h>
+#include <stdlib.h>
 #include "helpers.h"
 
 const int FILL_VALUE = -999;
@@ -97,4 +99,162 @@ void test_get_bin_window_even(void) {
                                56, 57, 58, 59};
     get_window(39, 4, 4, data, nbins_in_row, basebins, window);
     TEST_ASSERT_EQUAL_INT_ARRAY(expected_window, window, 16);
-}
\ No newline at end of file
+}
+void test_plane_round_trip(void) {
+    int data[150];
+    int expected[150];
+    for (int i = 0; i < 150; i++) {
+        data[i] = i % 7 == 3 ? FILL_VALUE : (i * 53) % 256;
+        expected[i] = data[i];
+    }
+    data[10] = 300;
+    expected[10] = 255;
+    data[20] = -4;
+    expected[20] = 0;
+    Plane *plane = new_plane(150);
+    plane_from_ints(plane, data, 256);
+    int out[150];
+    plane_to_ints(plane, out);
+    TEST_ASSERT_EQUAL_INT_ARRAY(expected, out, 150);
+    TEST_ASSERT_EQUAL_INT(0, bitmap_get(plane->valid, 66));
+    TEST_ASSERT_EQUAL_INT(1, bitmap_get(plane->valid, 64));
+    del_plane(plane);
+}
+
+void test_plane_levels(void) {
+    int data[4] = {4095, 5000, 300, FILL_VALUE};
+    int expected[4] = {4095, 4095, 300, FILL_VALUE};
+    Plane *plane = new_plane(4);
+    plane_from_ints(plane, data, 4096);
+    int out[4];
+    plane_to_ints(plane, out);
+    TEST_ASSERT_EQUAL_INT_ARRAY(expected, out, 4);
+    del_plane(plane);
+}
+
+void test_plane_window(void) {
+    int arr[102] = {148, 66, 169, 185, 255, 241,
+                    245, 216, 38, 110, 127, 2, 203,
+                    134, 99, 227, 186, 19, 173, 179, 51,
+                    141, 48, 221, 232, 72, 50, 166, 187, 11,
+                    181, 45, FILL_VALUE,  195, 53, 121, 252, 164, 39, 57,
+                    153, 6, 150, 226, FILL_VALUE, 202, 233, 133, 230, 160, 149,
+                    155, 211, 171, 31, 97, 8, 49, 123, 78, 95, 157,
+                    128, 183, 234, 62, 138, 143, 71, 126, 147, 239,
+                    7, 26, 3, 58, 207, 35, 122, 40, 129,
+                    115, 1, 42, 83, 75, 244, 188, 214,
+                    112, 55, 246, 47, 105, 98, 92,
+                    114, 88, 29, 193, 180, 24};
+    int n_bins_in_row[12] = {6,7,8,9,10,11,11,10,9,8,7,6};
+    int basebins[12] = {0, 6, 13, 21, 30, 40, 51, 62, 72, 81, 89, 96};
+    Plane *plane = new_plane(102);
+    plane_from_ints(plane, arr, 256);
+    int first_bins[5];
+    int window[25];
+    int expected_window[25];
+    for (int width = 3; width <= 5; width += 2) {
+        get_window_rows(44, 5, width, n_bins_in_row, basebins, first_bins);
+        int n_invalid = plane_window(plane, first_bins, width, window);
+        int expected_invalid = get_window(44, 5, width, arr, n_bins_in_row, basebins, expected_window);
+        TEST_ASSERT_EQUAL_INT_ARRAY(expected_window, window, width * width);
+        TEST_ASSERT_EQUAL_INT(expected_invalid, n_invalid);
+    }
+    del_plane(plane);
+}
+
+void test_bitmap_run(void) {
+    uint64_t bits[BITMAP_WORDS(128)] = {0};
+    for (int i = 60; i < 70; i += 2) {
+        bitmap_set(bits, i);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0x155, bitmap_run(bits, 60, 10));
+    TEST_ASSERT_EQUAL_UINT32(0x2, bitmap_run(bits, 63, 3));
+    bitmap_clear(bits, 64);
+    TEST_ASSERT_EQUAL_UINT32(0x0, bitmap_run(bits, 63, 3));
+    TEST_ASSERT_EQUAL_UINT32(0x4, bitmap_run(bits, 58, 4));
+}
+
+void test_new_grid_neighbor_columns(void) {
+    int n_bins_in_row[12] = {6,7,8,9,10,11,11,10,9,8,7,6};
+    int basebins[12] = {0, 6, 13, 21, 30, 40, 51, 62, 72, 81, 89, 96};
+    Grid *grid = new_grid(102, 12, n_bins_in_row, basebins);
+    TEST_ASSERT_NOT_NULL(grid);
+    for (int i = 0; i < 12; i++) {
+        for (int bin = basebins[i]; bin < basebins[i] + n_bins_in_row[i]; bin++) {
+            //The column the ratio between the position of the bin and the length of its row gives in each row
+            double ratio = ((double) bin - basebins[i]) / n_bins_in_row[i];
+            if (i > 0) {
+                TEST_ASSERT_EQUAL_INT((int) (ratio * n_bins_in_row[i - 1] + 0.5), grid->north[bin]);
+                TEST_ASSERT_EQUAL_INT(basebins[i - 1] + grid->north[bin], grid_neighbor(grid, bin, i, -1));
+            }
+            if (i < 11) {
+                TEST_ASSERT_EQUAL_INT((int) (ratio * n_bins_in_row[i + 1] + 0.5), grid->south[bin]);
+                TEST_ASSERT_EQUAL_INT(basebins[i + 1] + grid->south[bin], grid_neighbor(grid, bin, i, 1));
+            }
+        }
+    }
+    del_grid(grid);
+}
+
+void test_new_grid_row_too_long(void) {
+    int n_bins_in_row[3] = {10, 32769, 10};
+    int basebins[3] = {0, 10, 32779};
+    TEST_ASSERT_NULL(new_grid(32789, 3, n_bins_in_row, basebins));
+}
+
+/*
+ * Builds the rows of an integerized sinusoidal grid and returns its number of bins.
+ */
+static int isin_rows(int nrows, int *nbins_in_row, int *basebins) {
+    int nbins = 0;
+    for (int i = 0; i < nrows; i++) {
+        double lat = (i + 0.5) * 180.0 / nrows - 90;
+        nbins_in_row[i] = (int) floor(2 * nrows * cos(lat * M_PI / 180) + 0.5);
+        basebins[i] = nbins;
+        nbins += nbins_in_row[i];
+    }
+    return nbins;
+}
+
+void test_grid_window_isin(void) {
+    //Windows of every width the algorithm uses and one of the others, around every bin far enough from the poles
+    int nrows = 64;
+    int n_bins_in_row[64];
+    int basebins[64];
+    int nbins = isin_rows(nrows, n_bins_in_row, basebins);
+    int pad = 32;   //Windows at the ends of the rows nearest the poles reach past the first and last bin
+    int *values = malloc((nbins + 2 * pad) * sizeof(int));
+    int *bins = malloc((nbins + 2 * pad) * sizeof(int));
+    for (int i = 0; i < nbins + 2 * pad; i++) {
+        values[i] = i % 5 == 2 || i < pad || i >= nbins + pad ? FILL_VALUE : (i * 53) % 256;
+        bins[i] = i - pad;
+    }
+    const int *data = values + pad;
+    const int *bin_numbers = bins + pad;
+    Grid *grid = new_grid(nbins, nrows, n_bins_in_row, basebins);
+    int widths[4] = {3, 4, 5, 32};
+    int window[1024], expected_window[1024];
+    for (int w = 0; w < 4; w++) {
+        int width = widths[w];
+        for (int i = width / 2; i < nrows - width / 2; i++) {
+            for (int bin = basebins[i]; bin < basebins[i] + n_bins_in_row[i]; bin++) {
+                int n_fill = grid_window(grid, bin, i, width, data, window);
+                int expected_fill = get_window(bin, i, width, data, n_bins_in_row, basebins, expected_window);
+                TEST_ASSERT_EQUAL_INT_ARRAY(expected_window, window, width * width);
+                TEST_ASSERT_EQUAL_INT(expected_fill, n_fill);
+
+                grid_bin_window(grid, bin, i, width, window);
+                get_window(bin, i, width, bin_numbers, n_bins_in_row, basebins, expected_window);
+                TEST_ASSERT_EQUAL_INT_ARRAY(expected_window, window, width * width);
+                //get_bin_window puts odd windows one column east of those of get_window, and is only used for even ones
+                if (width % 2 == 0) {
+                    get_bin_window(bin, i, width, n_bins_in_row, basebins, expected_window);
+                    TEST_ASSERT_EQUAL_INT_ARRAY(expected_window, window, width * width);
+                }
+            }
+        }
+    }
+    del_grid(grid);
+    free(values);
+    free(bins);
+}
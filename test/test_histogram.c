@@ -3,6 +3,7 @@
 
 #include "unity.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include "histogram.h"
 
 
@@ -152,3 +153,104 @@ void test_histogram_analysis_too_small(void) {
     int threshold = histogram_analysis(window);
     TEST_ASSERT_EQUAL_INT(-1, threshold);
 }
+
+void test_get_histogram(void) {
+    int window[1024];
+    int expected[256] = {0};
+    for (int i = 0; i < 1024; i++) {
+        window[i] = i % 7 == 0 ? -999 : (i * 37) % 256;
+        if (window[i] != -999) expected[window[i]]++;
+    }
+    int histogram[256];
+    get_histogram(window, histogram);
+    TEST_ASSERT_EQUAL_INT_ARRAY(expected, histogram, 256);
+}
+
+void test_histogram_analysis_batch(void) {
+    int nwindows = 20;
+    int *windows = malloc(nwindows * 1024 * sizeof(int));
+    for (int w = 0; w < nwindows; w++) {
+        for (int i = 0; i < 1024; i++) {
+            int value;
+            if (w % 3 == 0) {
+                value = 40 + w;
+            } else if (w % 3 == 1) {
+                value = (i % 32) < 8 + w ? 20 + (i * 7) % 30 : 180 + (i * 13) % 40;
+            } else {
+                value = (i * 37 + w) % 256;
+            }
+            windows[w * 1024 + i] = i % 11 == w % 11 ? -999 : value;
+        }
+    }
+    int thresholds[20];
+    double thetas[20];
+    histogram_analysis_batch(windows, nwindows, 256, thresholds, thetas);
+    for (int w = 0; w < nwindows; w++) {
+        TEST_ASSERT_EQUAL_INT(histogram_analysis(windows + w * 1024), thresholds[w]);
+        if (thresholds[w] >= 0) TEST_ASSERT_TRUE(thetas[w] >= 0.7);
+    }
+    TEST_ASSERT_EQUAL_DOUBLE(0, thetas[0]);
+    TEST_ASSERT_TRUE(thresholds[1] > 0);
+    free(windows);
+}
+
+void test_histogram_analysis_batch_screens_flat_windows(void) {
+    int windows[3 * 1024];
+    for (int i = 0; i < 1024; i++) {
+        windows[i] = i % 5 == 0 ? -999 : 80;
+        windows[1024 + i] = i % 97 == 0 ? 140 : 80;
+        windows[2048 + i] = (i % 32) < 16 ? 80 : 140;
+    }
+    int thresholds[3];
+    double thetas[3];
+    TEST_ASSERT_EQUAL_INT(2, histogram_analysis_batch(windows, 3, 256, thresholds, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, thresholds[0]);
+    TEST_ASSERT_EQUAL_INT(-1, thresholds[1]);
+    TEST_ASSERT_EQUAL_INT(histogram_analysis(windows + 2048), thresholds[2]);
+    TEST_ASSERT_TRUE(thresholds[2] > 0);
+
+    //Asking for the separation scores analyzes every window
+    TEST_ASSERT_EQUAL_INT(0, histogram_analysis_batch(windows, 3, 256, thresholds, thetas));
+    TEST_ASSERT_EQUAL_INT(-1, thresholds[0]);
+    TEST_ASSERT_EQUAL_INT(-1, thresholds[1]);
+    TEST_ASSERT_EQUAL_INT(histogram_analysis(windows + 2048), thresholds[2]);
+    TEST_ASSERT_EQUAL_DOUBLE(0, thetas[0]);
+    //The outliers are split off perfectly, but are too few to make a front
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1, thetas[1]);
+}
+
+void test_histogram_analysis_symmetric_tie(void) {
+    int window[1024];
+    for (int i = 0; i < 1024; i++) {
+        window[i] = i < 400 ? 50 : i < 624 ? 100 : 150;
+    }
+    //Splitting off either outer value gives exactly the same between group variance
+    TEST_ASSERT_EQUAL_INT(101, histogram_analysis(window));
+}
+
+void test_histogram_analysis_batch_12_bit(void) {
+    int nwindows = 12;
+    int *windows = malloc(nwindows * 1024 * sizeof(int));
+    int *scaled = malloc(nwindows * 1024 * sizeof(int));
+    for (int w = 0; w < nwindows; w++) {
+        for (int i = 0; i < 1024; i++) {
+            int value = (i % 32) < 10 + w ? 30 + (i * 7 + w) % 25 : 150 + (i * 13) % 60;
+            windows[w * 1024 + i] = i % 13 == w ? -999 : value;
+            scaled[w * 1024 + i] = i % 13 == w ? -999 : value * 16;
+        }
+    }
+    int thresholds[12];
+    int scaled_thresholds[12];
+    double thetas[12];
+    double scaled_thetas[12];
+    histogram_analysis_batch(windows, nwindows, 256, thresholds, thetas);
+    histogram_analysis_batch(scaled, nwindows, 4096, scaled_thresholds, scaled_thetas);
+    for (int w = 0; w < nwindows; w++) {
+        //Scaling every value keeps the same split, just above the largest value of the low group
+        TEST_ASSERT_EQUAL_INT(thresholds[w] < 0 ? -1 : 16 * (thresholds[w] - 1) + 1, scaled_thresholds[w]);
+        TEST_ASSERT_DOUBLE_WITHIN(1e-9, thetas[w], scaled_thetas[w]);
+    }
+    TEST_ASSERT_TRUE(thresholds[0] > 0);
+    free(windows);
+    free(scaled);
+}
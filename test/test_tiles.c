@@ -0,0 +1,97 @@
+#include "unity.h"
+#include <stdlib.h>
+#include "helpers.h"
+#include "tiles.h"
+
+const int FILL_VALUE = -999;
+
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_tiles_load_band(void) {
+    int nrows = 64;
+    int nbins_in_row[64];
+    int basebins[64];
+    int nbins = 0;
+    for (int i = 0; i < nrows; i++) {
+        nbins_in_row[i] = 100 + (i % 7) * 3;
+        basebins[i] = nbins;
+        nbins += nbins_in_row[i];
+    }
+    int *data = malloc(nbins * sizeof(int));
+    for (int i = 0; i < nbins; i++) {
+        data[i] = (i * 37) % 256;
+    }
+    for (int i = 0; i < nbins; i += 19) {
+        data[i] = FILL_VALUE;
+    }
+    Plane *plane = new_plane(nbins);
+    plane_from_ints(plane, data, 256);
+    Grid *grid = new_grid(nbins, nrows, nbins_in_row, basebins);
+    Band *band = new_band(grid);
+
+    int ntiles = load_band(band, grid, plane, 31);
+    TEST_ASSERT_EQUAL_INT(3, ntiles);
+    TEST_ASSERT_EQUAL_INT(31, band->row);
+    TEST_ASSERT_EQUAL_INT(0, (size_t) band->values % 64);
+
+    int window[1024];
+    int bin_window[1024];
+    for (int i = 0; i < ntiles; i++) {
+        grid_window(grid, basebins[31] + 15 + i * 32, 31, 32, data, window);
+        grid_bin_window(grid, basebins[31] + 15 + i * 32, 31, 32, bin_window);
+        TEST_ASSERT_EQUAL_INT_ARRAY(window, band->values + i * 1024, 1024);
+        for (int k = 0; k < 32; k++) {
+            TEST_ASSERT_EQUAL_INT(bin_window[k * 32], band->first_bins[i * 32 + k]);
+        }
+    }
+    del_band(band);
+    del_grid(grid);
+    del_plane(plane);
+    free(data);
+}
+
+void test_tiles_scatter_tile(void) {
+    int nrows = 64;
+    int nbins_in_row[64];
+    int basebins[64];
+    int nbins = 0;
+    for (int i = 0; i < nrows; i++) {
+        nbins_in_row[i] = 90 + (i % 5) * 4;
+        basebins[i] = nbins;
+        nbins += nbins_in_row[i];
+    }
+    Plane *plane = new_plane(nbins);
+    uint64_t *out = new_bitmap(nbins);
+    Grid *grid = new_grid(nbins, nrows, nbins_in_row, basebins);
+    Band *band = new_band(grid);
+    load_band(band, grid, plane, 47);
+
+    uint32_t rows[32] = {0};
+    rows[0] = 1;
+    rows[1] = 1 << 1;
+    rows[31] = (uint32_t) 1 << 31;
+    int bin_window[1024];
+    grid_bin_window(grid, basebins[47] + 47, 47, 32, bin_window);
+    bitmap_set(out, bin_window[1]);
+    scatter_tile(band, 1, rows, out);
+
+    TEST_ASSERT_EQUAL_INT(1, bitmap_get(out, bin_window[0]));
+    TEST_ASSERT_EQUAL_INT(1, bitmap_get(out, bin_window[1]));
+    TEST_ASSERT_EQUAL_INT(1, bitmap_get(out, bin_window[33]));
+    TEST_ASSERT_EQUAL_INT(1, bitmap_get(out, bin_window[1023]));
+    int sum = 0;
+    for (int i = 0; i < nbins; i++) {
+        sum += bitmap_get(out, i);
+    }
+    TEST_ASSERT_EQUAL_INT(4, sum);
+
+    del_band(band);
+    del_grid(grid);
+    del_plane(plane);
+    free(out);
+}